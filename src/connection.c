@@ -45,39 +45,185 @@
 #define DIV_ROUNDUP(n, a) ( ((n) + ((a) - 1)) / (a) )
 
 struct wl_buffer {
-	char data[4096];
+	char *data;
 	uint32_t head, tail;
+	uint32_t size_bits;
+	uint32_t max_size_bits;
 };
 
-#define MASK(i) ((i) & 4095)
+#define WL_BUFFER_DEFAULT_SIZE_BITS	12
 
+/* At most MAX_FDS_OUT fds go out with each sendmsg(), since that's
+ * all older peers make room for when receiving.  We accept up to the
+ * kernel's SCM_MAX_FD per read. */
 #define MAX_FDS_OUT	28
+#define MAX_FDS_IN	253
 #define CLEN		(CMSG_LEN(MAX_FDS_OUT * sizeof(int32_t)))
+#define CLEN_IN		(CMSG_LEN(MAX_FDS_IN * sizeof(int32_t)))
+
+/* Outgoing fds are kept in their own queue, each tagged with the
+ * stream offset of the message that carries it, so a flush never
+ * sends an fd ahead of its message and can split sendmsg() calls at
+ * message boundaries. */
+#define WL_FD_QUEUE_MIN_SIZE	32
+#define WL_FD_QUEUE_MAX_SIZE	1024
+
+struct wl_fd_entry {
+	int32_t fd;
+	uint32_t offset;
+};
+
+struct wl_fd_queue {
+	struct wl_fd_entry *entries;
+	uint32_t head, tail, alloc;
+};
+
+/* Demarshalled closures are recycled through per size class free
+ * lists.  Class n holds closures with room for 2^(MIN_BITS + n) bytes
+ * of message payload; larger messages are malloc'ed and freed as
+ * before. */
+#define WL_CLOSURE_POOL_MIN_BITS	7
+#define WL_CLOSURE_POOL_CLASSES		6
+#define WL_CLOSURE_POOL_MAX_FREE	16
+
+struct wl_closure_pool {
+	struct wl_list free_list[WL_CLOSURE_POOL_CLASSES];
+	int free_count[WL_CLOSURE_POOL_CLASSES];
+	struct wl_closure_pool_stats stats;
+};
 
 struct wl_connection {
 	struct wl_buffer in, out;
-	struct wl_buffer fds_in, fds_out;
+	struct wl_buffer fds_in;
+	struct wl_fd_queue fds_out;
+	/* Bytes ever queued in out; the stream offset fds are tagged
+	 * with. */
+	uint32_t out_offset;
+	struct wl_connection_fd_stats fd_stats;
 	int fd;
 	int want_flush;
+	uint32_t overflow_flushes;
+	struct wl_closure_pool closure_pool;
+	uint32_t read_budget;
+	/* Bytes read since wl_connection_begin_read(), and whether the
+	 * last read left part of the ring unfilled. */
+	uint32_t read_bytes;
+	int read_short;
+	struct wl_connection_read_stats read_stats;
 };
 
+static inline uint32_t
+wl_buffer_capacity(const struct wl_buffer *b)
+{
+	return (uint32_t) 1 << b->size_bits;
+}
+
+static inline uint32_t
+wl_buffer_mask(const struct wl_buffer *b, uint32_t i)
+{
+	return i & (wl_buffer_capacity(b) - 1);
+}
+
+static uint32_t
+wl_buffer_size(struct wl_buffer *b)
+{
+	return b->head - b->tail;
+}
+
+static int
+wl_buffer_init(struct wl_buffer *b, uint32_t size_bits, uint32_t max_size_bits)
+{
+	b->data = malloc((size_t) 1 << size_bits);
+	if (b->data == NULL)
+		return -1;
+
+	b->head = 0;
+	b->tail = 0;
+	b->size_bits = size_bits;
+	b->max_size_bits = max_size_bits;
+
+	return 0;
+}
+
+static void
+wl_buffer_release(struct wl_buffer *b)
+{
+	free(b->data);
+	b->data = NULL;
+}
+
+static void
+wl_buffer_copy(struct wl_buffer *b, void *data, size_t count)
+{
+	uint32_t tail, size;
+
+	tail = wl_buffer_mask(b, b->tail);
+	if (tail + count <= wl_buffer_capacity(b)) {
+		memcpy(data, b->data + tail, count);
+	} else {
+		size = wl_buffer_capacity(b) - tail;
+		memcpy(data, b->data + tail, size);
+		memcpy((char *) data + size, b->data, count - size);
+	}
+}
+
+/* Make room for count more bytes, growing the ring to the next power
+ * of two if needed.  The buffer never grows past max_size_bits, in
+ * which case E2BIG is returned and the caller has to flush instead. */
+static int
+wl_buffer_ensure_space(struct wl_buffer *b, size_t count)
+{
+	uint32_t size, size_bits;
+	char *data;
+
+	size = wl_buffer_size(b);
+	if (size + count <= wl_buffer_capacity(b))
+		return 0;
+
+	size_bits = b->size_bits;
+	while (((size_t) 1 << size_bits) < size + count) {
+		if (size_bits >= b->max_size_bits) {
+			errno = E2BIG;
+			return -1;
+		}
+		size_bits++;
+	}
+
+	data = malloc((size_t) 1 << size_bits);
+	if (data == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	wl_buffer_copy(b, data, size);
+	free(b->data);
+
+	b->data = data;
+	b->size_bits = size_bits;
+	b->tail = 0;
+	b->head = size;
+
+	return 0;
+}
+
 static int
 wl_buffer_put(struct wl_buffer *b, const void *data, size_t count)
 {
 	uint32_t head, size;
 
-	if (count > sizeof(b->data)) {
-		wl_log("Data too big for buffer (%d > %d).\n",
-		       count, sizeof(b->data));
-		errno = E2BIG;
+	if (wl_buffer_ensure_space(b, count) < 0) {
+		if (errno == E2BIG)
+			wl_log("Data too big for buffer (%d + %d > %d).\n",
+			       wl_buffer_size(b), count,
+			       1 << b->max_size_bits);
 		return -1;
 	}
 
-	head = MASK(b->head);
-	if (head + count <= sizeof b->data) {
+	head = wl_buffer_mask(b, b->head);
+	if (head + count <= wl_buffer_capacity(b)) {
 		memcpy(b->data + head, data, count);
 	} else {
-		size = sizeof b->data - head;
+		size = wl_buffer_capacity(b) - head;
 		memcpy(b->data + head, data, size);
 		memcpy(b->data, (const char *) data + size, count - size);
 	}
@@ -92,19 +238,19 @@ wl_buffer_put_iov(struct wl_buffer *b, struct iovec *iov, int *count)
 {
 	uint32_t head, tail;
 
-	head = MASK(b->head);
-	tail = MASK(b->tail);
+	head = wl_buffer_mask(b, b->head);
+	tail = wl_buffer_mask(b, b->tail);
 	if (head < tail) {
 		iov[0].iov_base = b->data + head;
 		iov[0].iov_len = tail - head;
 		*count = 1;
 	} else if (tail == 0) {
 		iov[0].iov_base = b->data + head;
-		iov[0].iov_len = sizeof b->data - head;
+		iov[0].iov_len = wl_buffer_capacity(b) - head;
 		*count = 1;
 	} else {
 		iov[0].iov_base = b->data + head;
-		iov[0].iov_len = sizeof b->data - head;
+		iov[0].iov_len = wl_buffer_capacity(b) - head;
 		iov[1].iov_base = b->data;
 		iov[1].iov_len = tail;
 		*count = 2;
@@ -116,44 +262,166 @@ wl_buffer_get_iov(struct wl_buffer *b, struct iovec *iov, int *count)
 {
 	uint32_t head, tail;
 
-	head = MASK(b->head);
-	tail = MASK(b->tail);
+	head = wl_buffer_mask(b, b->head);
+	tail = wl_buffer_mask(b, b->tail);
 	if (tail < head) {
 		iov[0].iov_base = b->data + tail;
 		iov[0].iov_len = head - tail;
 		*count = 1;
 	} else if (head == 0) {
 		iov[0].iov_base = b->data + tail;
-		iov[0].iov_len = sizeof b->data - tail;
+		iov[0].iov_len = wl_buffer_capacity(b) - tail;
 		*count = 1;
 	} else {
 		iov[0].iov_base = b->data + tail;
-		iov[0].iov_len = sizeof b->data - tail;
+		iov[0].iov_len = wl_buffer_capacity(b) - tail;
 		iov[1].iov_base = b->data;
 		iov[1].iov_len = head;
 		*count = 2;
 	}
 }
 
+static uint32_t
+wl_fd_queue_size(struct wl_fd_queue *q)
+{
+	return q->head - q->tail;
+}
+
+static int
+wl_fd_queue_push(struct wl_fd_queue *q, int32_t fd, uint32_t offset)
+{
+	struct wl_fd_entry *entries;
+	uint32_t alloc;
+
+	if (q->head == q->alloc && q->tail > 0) {
+		memmove(q->entries, q->entries + q->tail,
+			wl_fd_queue_size(q) * sizeof *q->entries);
+		q->head -= q->tail;
+		q->tail = 0;
+	}
+
+	if (q->head == q->alloc) {
+		alloc = q->alloc ? q->alloc * 2 : WL_FD_QUEUE_MIN_SIZE;
+		if (alloc > WL_FD_QUEUE_MAX_SIZE) {
+			errno = EMFILE;
+			return -1;
+		}
+
+		entries = realloc(q->entries, alloc * sizeof *entries);
+		if (entries == NULL)
+			return -1;
+
+		q->entries = entries;
+		q->alloc = alloc;
+	}
+
+	q->entries[q->head].fd = fd;
+	q->entries[q->head].offset = offset;
+	q->head++;
+
+	return 0;
+}
+
+/* Close and drop the count oldest fds. */
 static void
-wl_buffer_copy(struct wl_buffer *b, void *data, size_t count)
+wl_fd_queue_close(struct wl_fd_queue *q, uint32_t count)
 {
-	uint32_t tail, size;
+	for (; count > 0 && q->tail < q->head; count--)
+		close(q->entries[q->tail++].fd);
 
-	tail = MASK(b->tail);
-	if (tail + count <= sizeof b->data) {
-		memcpy(data, b->data + tail, count);
+	if (q->tail == q->head)
+		q->head = q->tail = 0;
+}
+
+static int
+wl_fd_queue_full(struct wl_fd_queue *q)
+{
+	return wl_fd_queue_size(q) == WL_FD_QUEUE_MAX_SIZE;
+}
+
+static void
+wl_closure_pool_init(struct wl_closure_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < WL_CLOSURE_POOL_CLASSES; i++)
+		wl_list_init(&pool->free_list[i]);
+}
+
+static void
+wl_closure_pool_release(struct wl_closure_pool *pool)
+{
+	struct wl_closure *closure, *next;
+	int i;
+
+	for (i = 0; i < WL_CLOSURE_POOL_CLASSES; i++) {
+		wl_list_for_each_safe(closure, next, &pool->free_list[i], link)
+			free(closure);
+		wl_list_init(&pool->free_list[i]);
+		pool->free_count[i] = 0;
+	}
+}
+
+static struct wl_closure *
+wl_closure_pool_alloc(struct wl_closure_pool *pool, size_t extra)
+{
+	struct wl_closure *closure;
+	int class;
+
+	for (class = 0; class < WL_CLOSURE_POOL_CLASSES; class++)
+		if (extra <= (size_t) 1 << (WL_CLOSURE_POOL_MIN_BITS + class))
+			break;
+
+	if (class < WL_CLOSURE_POOL_CLASSES &&
+	    !wl_list_empty(&pool->free_list[class])) {
+		closure = container_of(pool->free_list[class].next,
+				       struct wl_closure, link);
+		wl_list_remove(&closure->link);
+		pool->free_count[class]--;
+		pool->stats.hits++;
 	} else {
-		size = sizeof b->data - tail;
-		memcpy(data, b->data + tail, size);
-		memcpy((char *) data + size, b->data, count - size);
+		if (class < WL_CLOSURE_POOL_CLASSES)
+			extra = (size_t) 1 << (WL_CLOSURE_POOL_MIN_BITS + class);
+		else
+			class = -1;
+
+		closure = malloc(sizeof *closure + extra);
+		if (closure == NULL)
+			return NULL;
+
+		closure->pool = pool;
+		closure->pool_class = class;
+		pool->stats.misses++;
+	}
+
+	pool->stats.in_use++;
+	if (pool->stats.in_use > pool->stats.high_water)
+		pool->stats.high_water = pool->stats.in_use;
+
+	return closure;
+}
+
+static void
+wl_closure_pool_free(struct wl_closure_pool *pool, struct wl_closure *closure)
+{
+	int class = closure->pool_class;
+
+	pool->stats.in_use--;
+
+	if (class < 0 || pool->free_count[class] >= WL_CLOSURE_POOL_MAX_FREE) {
+		free(closure);
+		return;
 	}
+
+	wl_list_insert(&pool->free_list[class], &closure->link);
+	pool->free_count[class]++;
 }
 
-static uint32_t
-wl_buffer_size(struct wl_buffer *b)
+void
+wl_connection_get_closure_pool_stats(struct wl_connection *connection,
+				     struct wl_closure_pool_stats *stats)
 {
-	return b->head - b->tail;
+	*stats = connection->closure_pool.stats;
 }
 
 struct wl_connection *
@@ -165,36 +433,74 @@ wl_connection_create(int fd)
 	if (connection == NULL)
 		return NULL;
 	memset(connection, 0, sizeof *connection);
+
+	if (wl_buffer_init(&connection->in, WL_BUFFER_DEFAULT_SIZE_BITS,
+			   WL_BUFFER_DEFAULT_SIZE_BITS) < 0 ||
+	    wl_buffer_init(&connection->out, WL_BUFFER_DEFAULT_SIZE_BITS,
+			   WL_BUFFER_DEFAULT_SIZE_BITS) < 0 ||
+	    wl_buffer_init(&connection->fds_in, WL_BUFFER_DEFAULT_SIZE_BITS,
+			   WL_BUFFER_DEFAULT_SIZE_BITS) < 0) {
+		wl_buffer_release(&connection->in);
+		wl_buffer_release(&connection->out);
+		wl_buffer_release(&connection->fds_in);
+		free(connection);
+		return NULL;
+	}
+
 	connection->fd = fd;
+	connection->read_budget = WL_CONNECTION_DEFAULT_READ_BUDGET;
+	wl_closure_pool_init(&connection->closure_pool);
 
 	return connection;
 }
 
+/* Set the maximum size the in and out rings may grow to.  The size is
+ * rounded up to a power of two and is never smaller than the default
+ * ring size.  Rings that already grew beyond the new limit keep their
+ * current size. */
+void
+wl_connection_set_max_buffer_size(struct wl_connection *connection,
+				  size_t max_buffer_size)
+{
+	uint32_t max_size_bits;
+
+	max_size_bits = WL_BUFFER_DEFAULT_SIZE_BITS;
+	while (((size_t) 1 << max_size_bits) < max_buffer_size &&
+	       max_size_bits < 31)
+		max_size_bits++;
+
+	connection->in.max_size_bits = max_size_bits;
+	connection->out.max_size_bits = max_size_bits;
+}
+
 static void
 close_fds(struct wl_buffer *buffer, int max)
 {
-	int32_t fds[sizeof(buffer->data) / sizeof(int32_t)], i, count;
-	size_t size;
-
-	size = buffer->head - buffer->tail;
-	if (size == 0)
-		return;
+	int32_t fd;
+	uint32_t i, count;
 
-	wl_buffer_copy(buffer, fds, size);
-	count = size / sizeof fds[0];
-	if (max > 0 && max < count)
+	count = wl_buffer_size(buffer) / sizeof fd;
+	if (max > 0 && (uint32_t) max < count)
 		count = max;
-	for (i = 0; i < count; i++)
-		close(fds[i]);
-	buffer->tail += size;
+
+	for (i = 0; i < count; i++) {
+		wl_buffer_copy(buffer, &fd, sizeof fd);
+		buffer->tail += sizeof fd;
+		close(fd);
+	}
 }
 
 void
 wl_connection_destroy(struct wl_connection *connection)
 {
-	close_fds(&connection->fds_out, -1);
+	wl_fd_queue_close(&connection->fds_out, -1);
+	free(connection->fds_out.entries);
 	close_fds(&connection->fds_in, -1);
 	close(connection->fd);
+	wl_closure_pool_release(&connection->closure_pool);
+	wl_buffer_release(&connection->in);
+	wl_buffer_release(&connection->out);
+	wl_buffer_release(&connection->fds_in);
 	free(connection);
 }
 
@@ -210,26 +516,53 @@ wl_connection_consume(struct wl_connection *connection, size_t size)
 	connection->in.tail += size;
 }
 
-static void
-build_cmsg(struct wl_buffer *buffer, char *data, int *clen)
+/* Attach the fds whose messages start within the first *len bytes of
+ * the out ring, at most MAX_FDS_OUT of them.  If more are due, *len is
+ * cut back to the start of the first message whose fds don't fit.
+ * Returns the number of fds attached. */
+static int
+build_cmsg(struct wl_connection *connection, char *data, int *clen,
+	   uint32_t *len)
 {
+	struct wl_fd_queue *q = &connection->fds_out;
 	struct cmsghdr *cmsg;
-	size_t size;
+	uint32_t base, offset, i, n;
+
+	base = connection->out_offset - wl_buffer_size(&connection->out);
+	for (n = 0, i = q->tail; i < q->head; n++, i++) {
+		offset = q->entries[i].offset - base;
+		if (offset >= *len)
+			break;
 
-	size = buffer->head - buffer->tail;
-	if (size > MAX_FDS_OUT * sizeof(int32_t))
-		size = MAX_FDS_OUT * sizeof(int32_t);
+		if (n == MAX_FDS_OUT) {
+			/* Leave out the message this fd belongs to,
+			 * along with the fds of it we already took. */
+			while (n > 0 && q->entries[i - 1].offset - base == offset) {
+				n--;
+				i--;
+			}
+			if (offset > 0)
+				*len = offset;
+			else
+				n = MAX_FDS_OUT;
+			break;
+		}
+	}
 
-	if (size > 0) {
+	if (n > 0) {
 		cmsg = (struct cmsghdr *) data;
 		cmsg->cmsg_level = SOL_SOCKET;
 		cmsg->cmsg_type = SCM_RIGHTS;
-		cmsg->cmsg_len = CMSG_LEN(size);
-		wl_buffer_copy(buffer, CMSG_DATA(cmsg), size);
+		cmsg->cmsg_len = CMSG_LEN(n * sizeof(int32_t));
+		for (i = 0; i < n; i++)
+			((int32_t *) CMSG_DATA(cmsg))[i] =
+				q->entries[q->tail + i].fd;
 		*clen = cmsg->cmsg_len;
 	} else {
 		*clen = 0;
 	}
+
+	return n;
 }
 
 static int
@@ -246,7 +579,7 @@ decode_cmsg(struct wl_buffer *buffer, struct msghdr *msg)
 			continue;
 
 		size = cmsg->cmsg_len - CMSG_LEN(0);
-		max = sizeof(buffer->data) - wl_buffer_size(buffer);
+		max = wl_buffer_capacity(buffer) - wl_buffer_size(buffer);
 		if (size > max || overflow) {
 			overflow = 1;
 			size /= sizeof(int32_t);
@@ -271,8 +604,8 @@ wl_connection_flush(struct wl_connection *connection)
 	struct iovec iov[2];
 	struct msghdr msg;
 	char cmsg[CLEN];
-	int len = 0, count, clen;
-	uint32_t tail;
+	int len = 0, count, clen, nfds;
+	uint32_t tail, size;
 
 	if (!connection->want_flush)
 		return 0;
@@ -281,7 +614,14 @@ wl_connection_flush(struct wl_connection *connection)
 	while (connection->out.head - connection->out.tail > 0) {
 		wl_buffer_get_iov(&connection->out, iov, &count);
 
-		build_cmsg(&connection->fds_out, cmsg, &clen);
+		size = wl_buffer_size(&connection->out);
+		nfds = build_cmsg(connection, cmsg, &clen, &size);
+		if (size < iov[0].iov_len) {
+			iov[0].iov_len = size;
+			count = 1;
+		} else if (count == 2) {
+			iov[1].iov_len = size - iov[0].iov_len;
+		}
 
 		msg.msg_name = NULL;
 		msg.msg_namelen = 0;
@@ -308,7 +648,11 @@ wl_connection_flush(struct wl_connection *connection)
 		if (len == -1)
 			return -1;
 
-		close_fds(&connection->fds_out, MAX_FDS_OUT);
+		if (nfds > 0) {
+			wl_fd_queue_close(&connection->fds_out, nfds);
+			connection->fd_stats.sent += nfds;
+			connection->fd_stats.sends++;
+		}
 
 		connection->out.tail += len;
 	}
@@ -323,15 +667,19 @@ wl_connection_read(struct wl_connection *connection)
 {
 	struct iovec iov[2];
 	struct msghdr msg;
-	char cmsg[CLEN];
+	char cmsg[CLEN_IN];
 	int len, count, ret;
+	uint32_t space, fds;
 
-	if (wl_buffer_size(&connection->in) >= sizeof(connection->in.data)) {
+	if (wl_buffer_size(&connection->in) >= wl_buffer_capacity(&connection->in) &&
+	    wl_buffer_ensure_space(&connection->in, 1) < 0) {
 		errno = EOVERFLOW;
 		return -1;
 	}
 
 	wl_buffer_put_iov(&connection->in, iov, &count);
+	space = wl_buffer_capacity(&connection->in) -
+		wl_buffer_size(&connection->in);
 
 	msg.msg_name = NULL;
 	msg.msg_namelen = 0;
@@ -348,71 +696,157 @@ wl_connection_read(struct wl_connection *connection)
 	if (len <= 0)
 		return len;
 
+	fds = wl_buffer_size(&connection->fds_in);
 	ret = decode_cmsg(&connection->fds_in, &msg);
 	if (ret)
 		return -1;
+	connection->fd_stats.received +=
+		(wl_buffer_size(&connection->fds_in) - fds) / sizeof(int32_t);
 
 	connection->in.head += len;
 
+	connection->read_stats.reads++;
+	connection->read_stats.bytes += len;
+	connection->read_bytes += len;
+	connection->read_short = (uint32_t) len < space;
+
 	return connection->in.head - connection->in.tail;
 }
 
+/* Start a batch of reads for one readiness event. */
+void
+wl_connection_begin_read(struct wl_connection *connection)
+{
+	connection->read_stats.wakeups++;
+	connection->read_bytes = 0;
+	connection->read_short = 0;
+}
+
+/* Whether to call wl_connection_read() again within the current batch,
+ * once the data from the last read has been handled.  A read that
+ * didn't fill the ring most likely emptied the socket, so the batch
+ * stops there rather than spending a syscall on EAGAIN.  A budget of 0
+ * limits each batch to a single read. */
 int
-wl_connection_write(struct wl_connection *connection,
-		    const void *data, size_t count)
+wl_connection_read_more(struct wl_connection *connection)
 {
-	if (connection->out.head - connection->out.tail +
-	    count > ARRAY_LENGTH(connection->out.data)) {
-		connection->want_flush = 1;
-		if (wl_connection_flush(connection) < 0)
-			return -1;
+	if (connection->read_short || connection->read_budget == 0)
+		return 0;
+
+	if (connection->read_bytes >= connection->read_budget) {
+		connection->read_stats.budget_hits++;
+		return 0;
 	}
 
-	if (wl_buffer_put(&connection->out, data, count) < 0)
-		return -1;
+	return 1;
+}
+
+void
+wl_connection_set_read_budget(struct wl_connection *connection,
+			      uint32_t budget)
+{
+	connection->read_budget = budget;
+}
+
+void
+wl_connection_get_read_stats(struct wl_connection *connection,
+			     struct wl_connection_read_stats *stats)
+{
+	*stats = connection->read_stats;
+}
+
+static int
+wl_connection_reserve(struct wl_connection *connection, size_t count)
+{
+	struct wl_buffer *out = &connection->out;
+
+	if (wl_buffer_size(out) + count <= wl_buffer_capacity(out))
+		return 0;
+
+	/* Grow the ring rather than flushing as long as we stay within
+	 * the configured maximum; only fall back to a synchronous flush
+	 * once the ring can't grow any further. */
+	if (wl_buffer_ensure_space(out, count) == 0)
+		return 0;
 
 	connection->want_flush = 1;
+	connection->overflow_flushes++;
+	return wl_connection_flush(connection);
+}
 
-	return 0;
+uint32_t
+wl_connection_pending_input(struct wl_connection *connection)
+{
+	return wl_buffer_size(&connection->in);
+}
+
+uint32_t
+wl_connection_pending_output(struct wl_connection *connection)
+{
+	return wl_buffer_size(&connection->out);
+}
+
+uint32_t
+wl_connection_get_overflow_flushes(struct wl_connection *connection)
+{
+	return connection->overflow_flushes;
 }
 
 int
-wl_connection_queue(struct wl_connection *connection,
+wl_connection_write(struct wl_connection *connection,
 		    const void *data, size_t count)
 {
-	if (connection->out.head - connection->out.tail +
-	    count > ARRAY_LENGTH(connection->out.data)) {
-		connection->want_flush = 1;
-		if (wl_connection_flush(connection) < 0)
-			return -1;
-	}
+	if (wl_connection_queue(connection, data, count) < 0)
+		return -1;
 
-	return wl_buffer_put(&connection->out, data, count);
+	connection->want_flush = 1;
+
+	return 0;
 }
 
-static int
-wl_message_count_arrays(const struct wl_message *message)
+int
+wl_connection_queue(struct wl_connection *connection,
+		    const void *data, size_t count)
 {
-	int i, arrays;
+	if (wl_connection_reserve(connection, count) < 0)
+		return -1;
 
-	for (i = 0, arrays = 0; message->signature[i]; i++) {
-		if (message->signature[i] == 'a')
-			arrays++;
-	}
+	if (wl_buffer_put(&connection->out, data, count) < 0)
+		return -1;
+
+	connection->out_offset += count;
 
-	return arrays;
+	return 0;
 }
 
+/* Queue an fd for the message about to be written to the out ring. */
 static int
 wl_connection_put_fd(struct wl_connection *connection, int32_t fd)
 {
-	if (wl_buffer_size(&connection->fds_out) == MAX_FDS_OUT * sizeof fd) {
+	struct wl_fd_queue *q = &connection->fds_out;
+
+	if (wl_fd_queue_full(q)) {
 		connection->want_flush = 1;
+		connection->overflow_flushes++;
+		connection->fd_stats.queue_flushes++;
 		if (wl_connection_flush(connection) < 0)
 			return -1;
 	}
 
-	return wl_buffer_put(&connection->fds_out, &fd, sizeof fd);
+	if (wl_fd_queue_push(q, fd, connection->out_offset) < 0)
+		return -1;
+
+	if (wl_fd_queue_size(q) > connection->fd_stats.queue_high_water)
+		connection->fd_stats.queue_high_water = wl_fd_queue_size(q);
+
+	return 0;
+}
+
+void
+wl_connection_get_fd_stats(struct wl_connection *connection,
+			   struct wl_connection_fd_stats *stats)
+{
+	*stats = connection->fd_stats;
 }
 
 const char *
@@ -472,6 +906,166 @@ wl_message_get_since(const struct wl_message *message)
 	return since;
 }
 
+#ifdef WL_MARSHAL_BENCHMARK
+int wl_closure_scalar_fast_path = 1;
+#else
+#define wl_closure_scalar_fast_path 1
+#endif
+
+static void
+wl_message_desc_compile(struct wl_message_desc *desc, const char *signature)
+{
+	struct argument_details arg;
+	int i, fixed;
+
+	memset(desc, 0, sizeof *desc);
+	desc->signature = signature;
+	desc->since = atoi(signature);
+	if (desc->since == 0)
+		desc->since = 1;
+	desc->fixed_size = 2 * sizeof(uint32_t);
+	desc->scalar = 1;
+	desc->self_contained = 1;
+
+	fixed = 1;
+	for (i = 0; ; i++) {
+		signature = get_next_argument(signature, &arg);
+		if (arg.type == '\0')
+			break;
+
+		if (i < WL_CLOSURE_MAX_ARGS) {
+			desc->types[i] = arg.type;
+			if (arg.nullable)
+				desc->nullable |= 1 << i;
+		}
+
+		switch (arg.type) {
+		case 'h':
+			desc->fd_count++;
+			break;
+		case 'a':
+			desc->array_count++;
+			/* fall through */
+		case 's':
+			fixed = 0;
+			break;
+		default:
+			if (fixed)
+				desc->fixed_size += sizeof(uint32_t);
+			break;
+		}
+
+		if (arg.type == 'o' && i < WL_CLOSURE_MAX_ARGS)
+			desc->objects |= 1 << i;
+		else if (arg.type != 'u' && arg.type != 'i' && arg.type != 'f')
+			desc->scalar = 0;
+
+		if (arg.type == 'o' || arg.type == 'n' || arg.type == 'h')
+			desc->self_contained = 0;
+
+		if (fixed)
+			desc->fixed_count = i + 1;
+	}
+
+	desc->count = i;
+	if (desc->count > WL_CLOSURE_MAX_ARGS)
+		desc->scalar = 0;
+}
+
+/* Compiled descriptors are cached in a fixed size, open addressed
+ * table keyed by the message pointer, so a hit costs no pass over the
+ * signature.  Slots are claimed with a compare-and-swap and never
+ * released, so lookups don't need a lock and can be shared by all
+ * threads and connections.  A slot also records the signature pointer,
+ * so a message struct that is rebuilt with a different signature
+ * misses.  Messages are expected to stay unchanged for as long as they
+ * are in use, as the tables emitted by the scanner do.  The one case
+ * this gets wrong is a message and its signature both being freed and
+ * their addresses reused for a different signature, for example by
+ * dlclose()ing a protocol library and loading another at the same
+ * address; that message would get the old descriptor. */
+#define WL_MESSAGE_DESC_CACHE_BITS	10
+#define WL_MESSAGE_DESC_CACHE_PROBES	32
+
+enum wl_message_desc_state {
+	WL_MESSAGE_DESC_EMPTY,
+	WL_MESSAGE_DESC_BUSY,
+	WL_MESSAGE_DESC_READY
+};
+
+/* Prepared libffi call interface for invoking a handler, one per
+ * signature and side (client or server; they differ in how new_id
+ * arguments are passed). */
+struct wl_closure_cif {
+	ffi_cif cif;
+	ffi_type *types[WL_CLOSURE_MAX_ARGS + 2];
+};
+
+struct wl_message_desc_slot {
+	int state;
+	const struct wl_message *message;
+	const char *signature;
+	struct wl_message_desc desc;
+	int cif_state[2];
+	struct wl_closure_cif cif[2];
+};
+
+static struct wl_message_desc_slot desc_cache[1 << WL_MESSAGE_DESC_CACHE_BITS];
+
+const struct wl_message_desc *
+wl_message_get_desc(const struct wl_message *message,
+		    struct wl_message_desc *storage)
+{
+	const char *signature = message->signature;
+	uint32_t hash, mask;
+	int i, state, expected;
+
+	mask = (1 << WL_MESSAGE_DESC_CACHE_BITS) - 1;
+	hash = (uint32_t) ((uintptr_t) message >> 3) * 2654435761u;
+	hash >>= 32 - WL_MESSAGE_DESC_CACHE_BITS;
+
+	for (i = 0; i < WL_MESSAGE_DESC_CACHE_PROBES; i++) {
+		struct wl_message_desc_slot *slot =
+			&desc_cache[(hash + i) & mask];
+
+		state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+		if (state == WL_MESSAGE_DESC_EMPTY) {
+			expected = WL_MESSAGE_DESC_EMPTY;
+			if (__atomic_compare_exchange_n(&slot->state, &expected,
+							WL_MESSAGE_DESC_BUSY, 0,
+							__ATOMIC_ACQ_REL,
+							__ATOMIC_ACQUIRE)) {
+				slot->message = message;
+				slot->signature = signature;
+				wl_message_desc_compile(&slot->desc,
+							signature);
+				slot->desc.cached = 1;
+				__atomic_store_n(&slot->state,
+						 WL_MESSAGE_DESC_READY,
+						 __ATOMIC_RELEASE);
+				return &slot->desc;
+			}
+			state = expected;
+		}
+
+		/* Another thread is filling in this slot; it only
+		 * takes a single pass over the signature. */
+		while (state == WL_MESSAGE_DESC_BUSY)
+			state = __atomic_load_n(&slot->state,
+						__ATOMIC_ACQUIRE);
+
+		/* A slot left behind by a message that has since changed
+		 * its signature keeps its place; probe on for a live one. */
+		if (slot->message == message && slot->signature == signature)
+			return &slot->desc;
+	}
+
+	/* The table is full; compile into the caller's storage. */
+	wl_message_desc_compile(storage, signature);
+
+	return storage;
+}
+
 void
 wl_argument_from_va_list(const char *signature, union wl_argument *args,
 			 int count, va_list ap)
@@ -515,58 +1109,56 @@ wl_argument_from_va_list(const char *signature, union wl_argument *args,
 	}
 }
 
-struct wl_closure *
-wl_closure_marshal(struct wl_object *sender, uint32_t opcode,
-		   union wl_argument *args,
-		   const struct wl_message *message)
+/* Marshal args into a caller provided closure.  This lets callers that
+ * send the closure right away keep it on the stack instead of going
+ * through malloc.  Such closures must not be passed to
+ * wl_closure_destroy(). */
+int
+wl_closure_init_marshal(struct wl_closure *closure, struct wl_object *sender,
+			uint32_t opcode, union wl_argument *args,
+			const struct wl_message *message)
 {
-	struct wl_closure *closure;
+	const struct wl_message_desc *desc;
 	struct wl_object *object;
 	int i, count, fd, dup_fd;
-	const char *signature;
-	struct argument_details arg;
 
-	count = arg_count_for_signature(message->signature);
+	desc = wl_message_get_desc(message, &closure->desc_storage);
+	count = desc->count;
 	if (count > WL_CLOSURE_MAX_ARGS) {
 		wl_log("too many args (%d)\n", count);
 		errno = EINVAL;
-		return NULL;
-	}
-
-	closure = malloc(sizeof *closure);
-	if (closure == NULL) {
-		errno = ENOMEM;
-		return NULL;
+		return -1;
 	}
 
 	memcpy(closure->args, args, count * sizeof *args);
 
-	signature = message->signature;
 	for (i = 0; i < count; i++) {
-		signature = get_next_argument(signature, &arg);
-
-		switch (arg.type) {
+		switch (desc->types[i]) {
 		case 'f':
 		case 'u':
 		case 'i':
 			break;
 		case 's':
-			if (!arg.nullable && args[i].s == NULL)
+			if (!wl_message_desc_nullable(desc, i) &&
+			    args[i].s == NULL)
 				goto err_null;
 			break;
 		case 'o':
-			if (!arg.nullable && args[i].o == NULL)
+			if (!wl_message_desc_nullable(desc, i) &&
+			    args[i].o == NULL)
 				goto err_null;
 			break;
 		case 'n':
 			object = args[i].o;
-			if (!arg.nullable && object == NULL)
+			if (!wl_message_desc_nullable(desc, i) &&
+			    object == NULL)
 				goto err_null;
 
 			closure->args[i].n = object ? object->id : 0;
 			break;
 		case 'a':
-			if (!arg.nullable && args[i].a == NULL)
+			if (!wl_message_desc_nullable(desc, i) &&
+			    args[i].a == NULL)
 				goto err_null;
 			break;
 		case 'h':
@@ -580,7 +1172,7 @@ wl_closure_marshal(struct wl_object *sender, uint32_t opcode,
 			break;
 		default:
 			wl_log("unhandled format code: '%c'\n",
-				arg.type);
+				desc->types[i]);
 			assert(0);
 			break;
 		}
@@ -589,17 +1181,40 @@ wl_closure_marshal(struct wl_object *sender, uint32_t opcode,
 	closure->sender_id = sender->id;
 	closure->opcode = opcode;
 	closure->message = message;
+	closure->desc = desc;
 	closure->count = count;
 
-	return closure;
+	return 0;
 
 err_null:
-	wl_closure_destroy(closure);
 	wl_log("error marshalling arguments for %s (signature %s): "
 	       "null value passed for arg %i\n", message->name,
 	       message->signature, i);
 	errno = EINVAL;
-	return NULL;
+	return -1;
+}
+
+struct wl_closure *
+wl_closure_marshal(struct wl_object *sender, uint32_t opcode,
+		   union wl_argument *args,
+		   const struct wl_message *message)
+{
+	struct wl_closure *closure;
+
+	closure = malloc(sizeof *closure);
+	if (closure == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	closure->pool = NULL;
+	if (wl_closure_init_marshal(closure, sender, opcode,
+				    args, message) < 0) {
+		wl_closure_destroy(closure);
+		return NULL;
+	}
+
+	return closure;
 }
 
 struct wl_closure *
@@ -614,58 +1229,84 @@ wl_closure_vmarshal(struct wl_object *sender, uint32_t opcode, va_list ap,
 	return wl_closure_marshal(sender, opcode, args, message);
 }
 
-struct wl_closure *
-wl_connection_demarshal(struct wl_connection *connection,
-			uint32_t size,
-			struct wl_map *objects,
-			const struct wl_message *message)
+/* Reject null ids for non-nullable object arguments of a scalar
+ * message. */
+static int
+wl_closure_check_objects(struct wl_closure *closure,
+			 const struct wl_message *message)
 {
-	uint32_t *p, *next, *end, length, id;
-	int fd;
-	char *s;
-	unsigned int i, count, num_arrays;
-	const char *signature;
-	struct argument_details arg;
-	struct wl_closure *closure;
-	struct wl_array *array, *array_extra;
+	const struct wl_message_desc *desc = closure->desc;
+	uint32_t mask = desc->objects & ~desc->nullable;
+	int i;
 
-	count = arg_count_for_signature(message->signature);
-	if (count > WL_CLOSURE_MAX_ARGS) {
-		wl_log("too many args (%d)\n", count);
-		errno = EINVAL;
-		wl_connection_consume(connection, size);
-		return NULL;
+	for (; mask; mask &= mask - 1) {
+		i = __builtin_ctz(mask);
+		if (closure->args[i].n == 0) {
+			wl_log("NULL object received on non-nullable "
+			       "type, message %s(%s)\n", message->name,
+			       message->signature);
+			errno = EINVAL;
+			return -1;
+		}
 	}
 
-	num_arrays = wl_message_count_arrays(message);
-	closure = malloc(sizeof *closure + size + num_arrays * sizeof *array);
-	if (closure == NULL) {
-		errno = ENOMEM;
-		wl_connection_consume(connection, size);
-		return NULL;
-	}
+	return 0;
+}
 
-	array_extra = closure->extra;
-	p = (uint32_t *)(closure->extra + num_arrays);
-	end = p + size / sizeof *p;
+/* Parse the arguments of a message laid out in [p, end), after the
+ * header.  String and array arguments point into that memory. */
+static int
+wl_connection_demarshal_args(struct wl_connection *connection,
+			     struct wl_closure *closure,
+			     uint32_t *p, uint32_t *end,
+			     struct wl_map *objects,
+			     const struct wl_message *message)
+{
+	const struct wl_message_desc *desc = closure->desc;
+	uint32_t *next, length, id;
+	int fd;
+	char *s;
+	unsigned int i, count = desc->count;
+	struct wl_array *array_extra = closure->extra;
 
-	wl_connection_copy(connection, p, size);
 	closure->sender_id = *p++;
 	closure->opcode = *p++ & 0x0000ffff;
 
-	signature = message->signature;
-	for (i = 0; i < count; i++) {
-		signature = get_next_argument(signature, &arg);
+	if (desc->scalar && wl_closure_scalar_fast_path) {
+		/* Every argument is one word: check the size once and
+		 * copy them over. */
+		if (end - p < (int) count) {
+			wl_log("message too short, "
+			       "object (%d), message %s(%s)\n",
+			       closure->sender_id, message->name,
+			       message->signature);
+			errno = EINVAL;
+			return -1;
+		}
+
+		for (i = 0; i < count; i++)
+			closure->args[i].u = p[i];
+
+		if (desc->objects & ~desc->nullable &&
+		    wl_closure_check_objects(closure, message) < 0)
+			return -1;
 
-		if (arg.type != 'h' && p + 1 > end) {
+		closure->count = count;
+		closure->message = message;
+
+		return 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (desc->types[i] != 'h' && p + 1 > end) {
 			wl_log("message too short, "
 			       "object (%d), message %s(%s)\n",
 			       *p, message->name, message->signature);
 			errno = EINVAL;
-			goto err;
+			return -1;
 		}
 
-		switch (arg.type) {
+		switch (desc->types[i]) {
 		case 'u':
 			closure->args[i].u = *p++;
 			break;
@@ -690,7 +1331,7 @@ wl_connection_demarshal(struct wl_connection *connection,
 				       closure->sender_id, message->name,
 				       message->signature);
 				errno = EINVAL;
-				goto err;
+				return -1;
 			}
 
 			s = (char *) p;
@@ -700,7 +1341,7 @@ wl_connection_demarshal(struct wl_connection *connection,
 				       "message %s(%s)\n",
 				       message->name, message->signature);
 				errno = EINVAL;
-				goto err;
+				return -1;
 			}
 
 			closure->args[i].s = s;
@@ -710,24 +1351,24 @@ wl_connection_demarshal(struct wl_connection *connection,
 			id = *p++;
 			closure->args[i].n = id;
 
-			if (id == 0 && !arg.nullable) {
+			if (id == 0 && !wl_message_desc_nullable(desc, i)) {
 				wl_log("NULL object received on non-nullable "
 				       "type, message %s(%s)\n", message->name,
 				       message->signature);
 				errno = EINVAL;
-				goto err;
+				return -1;
 			}
 			break;
 		case 'n':
 			id = *p++;
 			closure->args[i].n = id;
 
-			if (id == 0 && !arg.nullable) {
+			if (id == 0 && !wl_message_desc_nullable(desc, i)) {
 				wl_log("NULL new ID received on non-nullable "
 				       "type, message %s(%s)\n", message->name,
 				       message->signature);
 				errno = EINVAL;
-				goto err;
+				return -1;
 			}
 
 			if (wl_map_reserve_new(objects, id) < 0) {
@@ -735,7 +1376,7 @@ wl_connection_demarshal(struct wl_connection *connection,
 				       "message %s(%s)\n",
 				       id, message->name, message->signature);
 				errno = EINVAL;
-				goto err;
+				return -1;
 			}
 
 			break;
@@ -749,7 +1390,7 @@ wl_connection_demarshal(struct wl_connection *connection,
 				       closure->sender_id, message->name,
 				       message->signature);
 				errno = EINVAL;
-				goto err;
+				return -1;
 			}
 
 			array_extra->size = length;
@@ -766,7 +1407,7 @@ wl_connection_demarshal(struct wl_connection *connection,
 				       closure->sender_id, message->name,
 				       message->signature);
 				errno = EINVAL;
-				goto err;
+				return -1;
 			}
 
 			wl_buffer_copy(&connection->fds_in, &fd, sizeof fd);
@@ -783,15 +1424,177 @@ wl_connection_demarshal(struct wl_connection *connection,
 	closure->count = count;
 	closure->message = message;
 
+	return 0;
+}
+
+/* desc comes from wl_message_get_desc(); if it isn't cached, it is
+ * copied into the closure. */
+static struct wl_closure *
+wl_connection_demarshal_alloc(struct wl_connection *connection,
+			      size_t size,
+			      const struct wl_message_desc *desc)
+{
+	struct wl_closure *closure;
+
+	if (desc->count > WL_CLOSURE_MAX_ARGS) {
+		wl_log("too many args (%d)\n", desc->count);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	closure = wl_closure_pool_alloc(&connection->closure_pool,
+					size + desc->array_count *
+					sizeof (struct wl_array));
+	if (closure == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (!desc->cached) {
+		closure->desc_storage = *desc;
+		desc = &closure->desc_storage;
+	}
+	closure->desc = desc;
+	closure->raw_size = 0;
+
+	return closure;
+}
+
+struct wl_closure *
+wl_connection_demarshal(struct wl_connection *connection,
+			uint32_t size,
+			struct wl_map *objects,
+			const struct wl_message *message)
+{
+	const struct wl_message_desc *desc;
+	struct wl_message_desc desc_storage;
+	struct wl_closure *closure;
+	uint32_t *p;
+
+	desc = wl_message_get_desc(message, &desc_storage);
+	closure = wl_connection_demarshal_alloc(connection, size, desc);
+	if (closure == NULL) {
+		wl_connection_consume(connection, size);
+		return NULL;
+	}
+
+	p = (uint32_t *)(closure->extra + closure->desc->array_count);
+	wl_connection_copy(connection, p, size);
 	wl_connection_consume(connection, size);
+	connection->closure_pool.stats.copied++;
+
+	if (wl_connection_demarshal_args(connection, closure,
+					 p, p + size / sizeof *p,
+					 objects, message) < 0) {
+		wl_closure_destroy(closure);
+		return NULL;
+	}
 
 	return closure;
+}
+
+/* Copy a message out of the input buffer without parsing it, so that
+ * wl_closure_decode() can do that later, possibly on another thread.
+ * Only for messages whose descriptor, which the caller has already
+ * looked up, is self_contained; only the header fields and message of
+ * the closure are valid until then. */
+struct wl_closure *
+wl_connection_demarshal_raw(struct wl_connection *connection,
+			    uint32_t size,
+			    const struct wl_message *message,
+			    const struct wl_message_desc *desc)
+{
+	struct wl_closure *closure;
+	uint32_t *p;
 
- err:
-	wl_closure_destroy(closure);
+	closure = wl_connection_demarshal_alloc(connection, size, desc);
+	if (closure == NULL) {
+		wl_connection_consume(connection, size);
+		return NULL;
+	}
+
+	assert(closure->desc->self_contained);
+
+	p = (uint32_t *)(closure->extra + closure->desc->array_count);
+	wl_connection_copy(connection, p, size);
 	wl_connection_consume(connection, size);
+	connection->closure_pool.stats.copied++;
+
+	closure->sender_id = p[0];
+	closure->opcode = p[1] & 0x0000ffff;
+	closure->message = message;
+	closure->count = 0;
+	closure->raw_size = size;
+
+	return closure;
+}
+
+/* Parse the arguments of a closure from wl_connection_demarshal_raw().
+ * Needs no locking, as it only touches the closure itself. */
+int
+wl_closure_decode(struct wl_closure *closure)
+{
+	uint32_t *p;
+	int ret;
+
+	if (closure->raw_size == 0)
+		return 0;
+
+	p = (uint32_t *)(closure->extra + closure->desc->array_count);
+	ret = wl_connection_demarshal_args(NULL, closure, p,
+					   p + closure->raw_size / sizeof *p,
+					   NULL, closure->message);
+	closure->raw_size = 0;
+
+	return ret;
+}
+
+/* Like wl_connection_demarshal(), but when the message doesn't wrap
+ * around the end of the input buffer its arguments are parsed where
+ * they are and strings and arrays point into the buffer.  The message
+ * is never consumed: the caller must call wl_connection_consume()
+ * once the closure has been destroyed, and must not read from the
+ * connection in between.  desc is the message's descriptor, which the
+ * caller has usually looked up already. */
+struct wl_closure *
+wl_connection_demarshal_in_place(struct wl_connection *connection,
+				 uint32_t size,
+				 struct wl_map *objects,
+				 const struct wl_message *message,
+				 const struct wl_message_desc *desc)
+{
+	struct wl_buffer *b = &connection->in;
+	struct wl_closure *closure;
+	uint32_t tail, *p;
+
+	tail = wl_buffer_mask(b, b->tail);
+	if (tail + size > wl_buffer_capacity(b)) {
+		closure = wl_connection_demarshal_alloc(connection, size,
+							desc);
+		if (closure == NULL)
+			return NULL;
+
+		p = (uint32_t *)(closure->extra + closure->desc->array_count);
+		wl_connection_copy(connection, p, size);
+		connection->closure_pool.stats.copied++;
+	} else {
+		closure = wl_connection_demarshal_alloc(connection, 0,
+							desc);
+		if (closure == NULL)
+			return NULL;
+
+		p = (uint32_t *) (b->data + tail);
+		connection->closure_pool.stats.in_place++;
+	}
+
+	if (wl_connection_demarshal_args(connection, closure,
+					 p, p + size / sizeof *p,
+					 objects, message) < 0) {
+		wl_closure_destroy(closure);
+		return NULL;
+	}
 
-	return NULL;
+	return closure;
 }
 
 int
@@ -812,17 +1615,14 @@ wl_closure_lookup_objects(struct wl_closure *closure, struct wl_map *objects)
 {
 	struct wl_object *object;
 	const struct wl_message *message;
-	const char *signature;
-	struct argument_details arg;
-	int i, count;
+	const struct wl_message_desc *desc;
+	int i;
 	uint32_t id;
 
 	message = closure->message;
-	signature = message->signature;
-	count = arg_count_for_signature(signature);
-	for (i = 0; i < count; i++) {
-		signature = get_next_argument(signature, &arg);
-		switch (arg.type) {
+	desc = closure->desc;
+	for (i = 0; i < desc->count; i++) {
+		switch (desc->types[i]) {
 		case 'o':
 			id = closure->args[i].n;
 			closure->args[i].o = NULL;
@@ -858,55 +1658,35 @@ wl_closure_lookup_objects(struct wl_closure *closure, struct wl_map *objects)
 }
 
 static void
-convert_arguments_to_ffi(const char *signature, uint32_t flags,
-			 union wl_argument *args,
-			 int count, ffi_type **ffi_types, void** ffi_args)
+wl_closure_cif_prepare(struct wl_closure_cif *closure_cif,
+		       const struct wl_message_desc *desc, uint32_t flags)
 {
+	ffi_type **ffi_types = closure_cif->types;
 	int i;
-	const char *sig_iter;
-	struct argument_details arg;
 
-	sig_iter = signature;
-	for (i = 0; i < count; i++) {
-		sig_iter = get_next_argument(sig_iter, &arg);
+	ffi_types[0] = &ffi_type_pointer;
+	ffi_types[1] = &ffi_type_pointer;
 
-		switch(arg.type) {
+	for (i = 0; i < desc->count; i++) {
+		switch(desc->types[i]) {
 		case 'i':
-			ffi_types[i] = &ffi_type_sint32;
-			ffi_args[i] = &args[i].i;
+		case 'f':
+		case 'h':
+			ffi_types[i + 2] = &ffi_type_sint32;
 			break;
 		case 'u':
-			ffi_types[i] = &ffi_type_uint32;
-			ffi_args[i] = &args[i].u;
-			break;
-		case 'f':
-			ffi_types[i] = &ffi_type_sint32;
-			ffi_args[i] = &args[i].f;
+			ffi_types[i + 2] = &ffi_type_uint32;
 			break;
 		case 's':
-			ffi_types[i] = &ffi_type_pointer;
-			ffi_args[i] = &args[i].s;
-			break;
 		case 'o':
-			ffi_types[i] = &ffi_type_pointer;
-			ffi_args[i] = &args[i].o;
-			break;
-		case 'n':
-			if (flags & WL_CLOSURE_INVOKE_CLIENT) {
-				ffi_types[i] = &ffi_type_pointer;
-				ffi_args[i] = &args[i].o;
-			} else {
-				ffi_types[i] = &ffi_type_uint32;
-				ffi_args[i] = &args[i].n;
-			}
-			break;
 		case 'a':
-			ffi_types[i] = &ffi_type_pointer;
-			ffi_args[i] = &args[i].a;
+			ffi_types[i + 2] = &ffi_type_pointer;
 			break;
-		case 'h':
-			ffi_types[i] = &ffi_type_sint32;
-			ffi_args[i] = &args[i].h;
+		case 'n':
+			if (flags & WL_CLOSURE_INVOKE_CLIENT)
+				ffi_types[i + 2] = &ffi_type_pointer;
+			else
+				ffi_types[i + 2] = &ffi_type_uint32;
 			break;
 		default:
 			wl_log("unknown type\n");
@@ -914,33 +1694,72 @@ convert_arguments_to_ffi(const char *signature, uint32_t flags,
 			break;
 		}
 	}
+
+	ffi_prep_cif(&closure_cif->cif, FFI_DEFAULT_ABI,
+		     desc->count + 2, &ffi_type_void, ffi_types);
+}
+
+/* Look up the prepared call interface for a cached descriptor,
+ * preparing it on first use.  Uses the same claim/publish protocol as
+ * the descriptor cache, so concurrent event queues can share it. */
+static ffi_cif *
+wl_closure_get_cif(const struct wl_message_desc *desc, uint32_t flags,
+		   struct wl_closure_cif *storage)
+{
+	struct wl_message_desc_slot *slot;
+	int side, state, expected;
+
+	if (!desc->cached) {
+		wl_closure_cif_prepare(storage, desc, flags);
+		return &storage->cif;
+	}
+
+	slot = container_of(desc, struct wl_message_desc_slot, desc);
+	side = (flags & WL_CLOSURE_INVOKE_CLIENT) ? 0 : 1;
+
+	state = __atomic_load_n(&slot->cif_state[side], __ATOMIC_ACQUIRE);
+	if (state == WL_MESSAGE_DESC_READY)
+		return &slot->cif[side].cif;
+
+	expected = WL_MESSAGE_DESC_EMPTY;
+	if (__atomic_compare_exchange_n(&slot->cif_state[side], &expected,
+					WL_MESSAGE_DESC_BUSY, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		wl_closure_cif_prepare(&slot->cif[side], desc, flags);
+		__atomic_store_n(&slot->cif_state[side],
+				 WL_MESSAGE_DESC_READY, __ATOMIC_RELEASE);
+		return &slot->cif[side].cif;
+	}
+
+	while (__atomic_load_n(&slot->cif_state[side],
+			       __ATOMIC_ACQUIRE) != WL_MESSAGE_DESC_READY)
+		;
+
+	return &slot->cif[side].cif;
 }
 
 void
 wl_closure_invoke(struct wl_closure *closure, uint32_t flags,
 		  struct wl_object *target, uint32_t opcode, void *data)
 {
-	int count;
-	ffi_cif cif;
-	ffi_type *ffi_types[WL_CLOSURE_MAX_ARGS + 2];
+	const struct wl_message_desc *desc = closure->desc;
+	struct wl_closure_cif storage;
+	ffi_cif *cif;
 	void * ffi_args[WL_CLOSURE_MAX_ARGS + 2];
 	void (* const *implementation)(void);
+	int i;
 
-	count = arg_count_for_signature(closure->message->signature);
+	cif = wl_closure_get_cif(desc, flags, &storage);
 
-	ffi_types[0] = &ffi_type_pointer;
+	/* Every argument type is read straight out of the wl_argument
+	 * union, so only the argument pointers change per call. */
 	ffi_args[0] = &data;
-	ffi_types[1] = &ffi_type_pointer;
 	ffi_args[1] = &target;
-
-	convert_arguments_to_ffi(closure->message->signature, flags, closure->args,
-				 count, ffi_types + 2, ffi_args + 2);
-
-	ffi_prep_cif(&cif, FFI_DEFAULT_ABI,
-		     count + 2, &ffi_type_void, ffi_types);
+	for (i = 0; i < desc->count; i++)
+		ffi_args[i + 2] = &closure->args[i];
 
 	implementation = target->implementation;
-	ffi_call(&cif, implementation[opcode], NULL, ffi_args);
+	ffi_call(cif, implementation[opcode], NULL, ffi_args);
 }
 
 void
@@ -955,16 +1774,14 @@ static int
 copy_fds_to_connection(struct wl_closure *closure,
 		       struct wl_connection *connection)
 {
-	const struct wl_message *message = closure->message;
-	uint32_t i, count;
-	struct argument_details arg;
-	const char *signature = message->signature;
-	int fd;
+	const struct wl_message_desc *desc = closure->desc;
+	int i, fd;
 
-	count = arg_count_for_signature(signature);
-	for (i = 0; i < count; i++) {
-		signature = get_next_argument(signature, &arg);
-		if (arg.type != 'h')
+	if (desc->fd_count == 0)
+		return 0;
+
+	for (i = 0; i < desc->count; i++) {
+		if (desc->types[i] != 'h')
 			continue;
 
 		fd = closure->args[i].h;
@@ -982,18 +1799,15 @@ copy_fds_to_connection(struct wl_closure *closure,
 static uint32_t
 buffer_size_for_closure(struct wl_closure *closure)
 {
-	const struct wl_message *message = closure->message;
-	int i, count;
-	struct argument_details arg;
-	const char *signature;
-	uint32_t size, buffer_size = 0;
-
-	signature = message->signature;
-	count = arg_count_for_signature(signature);
-	for (i = 0; i < count; i++) {
-		signature = get_next_argument(signature, &arg);
+	const struct wl_message_desc *desc = closure->desc;
+	int i;
+	uint32_t size, buffer_size;
 
-		switch (arg.type) {
+	/* Everything up to the first string or array has a fixed size,
+	 * including the two word header. */
+	buffer_size = desc->fixed_size / sizeof(uint32_t);
+	for (i = desc->fixed_count; i < desc->count; i++) {
+		switch (desc->types[i]) {
 		case 'h':
 			break;
 		case 'u':
@@ -1026,18 +1840,17 @@ buffer_size_for_closure(struct wl_closure *closure)
 		}
 	}
 
-	return buffer_size + 2;
+	return buffer_size;
 }
 
 static int
 serialize_closure(struct wl_closure *closure, uint32_t *buffer,
 		  size_t buffer_count)
 {
-	const struct wl_message *message = closure->message;
-	unsigned int i, count, size;
-	uint32_t *p, *end;
-	struct argument_details arg;
-	const char *signature;
+	const struct wl_message_desc *desc = closure->desc;
+	unsigned int size;
+	int i;
+	uint32_t *p, *end, mask;
 
 	if (buffer_count < 2)
 		goto overflow;
@@ -1045,18 +1858,32 @@ serialize_closure(struct wl_closure *closure, uint32_t *buffer,
 	p = buffer + 2;
 	end = buffer + buffer_count;
 
-	signature = message->signature;
-	count = arg_count_for_signature(signature);
-	for (i = 0; i < count; i++) {
-		signature = get_next_argument(signature, &arg);
+	if (desc->scalar && wl_closure_scalar_fast_path) {
+		/* One word per argument: check the size once, copy the
+		 * words and patch in the object ids. */
+		if (end - p < desc->count)
+			goto overflow;
+
+		for (i = 0; i < desc->count; i++)
+			p[i] = closure->args[i].u;
+
+		for (mask = desc->objects; mask; mask &= mask - 1) {
+			i = __builtin_ctz(mask);
+			p[i] = closure->args[i].o ? closure->args[i].o->id : 0;
+		}
+
+		p += desc->count;
+		goto done;
+	}
 
-		if (arg.type == 'h')
+	for (i = 0; i < desc->count; i++) {
+		if (desc->types[i] == 'h')
 			continue;
 
 		if (p + 1 > end)
 			goto overflow;
 
-		switch (arg.type) {
+		switch (desc->types[i]) {
 		case 'u':
 			*p++ = closure->args[i].u;
 			break;
@@ -1107,6 +1934,7 @@ serialize_closure(struct wl_closure *closure, uint32_t *buffer,
 		}
 	}
 
+done:
 	size = (p - buffer) * sizeof *p;
 
 	buffer[0] = closure->sender_id;
@@ -1119,68 +1947,61 @@ overflow:
 	return -1;
 }
 
-int
-wl_closure_send(struct wl_closure *closure, struct wl_connection *connection)
+/* Most messages are small enough to be serialized on the stack; only
+ * fall back to malloc for the occasional large string or array. */
+#define WL_CLOSURE_STACK_BUFFER_SIZE	256
+
+static int
+serialize_and_write(struct wl_closure *closure,
+		    struct wl_connection *connection,
+		    int (*write)(struct wl_connection *connection,
+				 const void *data, size_t count))
 {
-	int size;
+	uint32_t stack_buffer[WL_CLOSURE_STACK_BUFFER_SIZE];
 	uint32_t buffer_size;
 	uint32_t *buffer;
-	int result;
+	int size, result;
 
 	if (copy_fds_to_connection(closure, connection))
 		return -1;
 
 	buffer_size = buffer_size_for_closure(closure);
-	buffer = malloc(buffer_size * sizeof buffer[0]);
-	if (buffer == NULL)
-		return -1;
+	if (buffer_size <= ARRAY_LENGTH(stack_buffer)) {
+		buffer = stack_buffer;
+	} else {
+		buffer = malloc(buffer_size * sizeof buffer[0]);
+		if (buffer == NULL)
+			return -1;
+	}
 
 	size = serialize_closure(closure, buffer, buffer_size);
-	if (size < 0) {
-		free(buffer);
-		return -1;
-	}
+	if (size < 0)
+		result = -1;
+	else
+		result = write(connection, buffer, size);
 
-	result = wl_connection_write(connection, buffer, size);
-	free(buffer);
+	if (buffer != stack_buffer)
+		free(buffer);
 
 	return result;
 }
 
 int
-wl_closure_queue(struct wl_closure *closure, struct wl_connection *connection)
+wl_closure_send(struct wl_closure *closure, struct wl_connection *connection)
 {
-	int size;
-	uint32_t buffer_size;
-	uint32_t *buffer;
-	int result;
-
-	if (copy_fds_to_connection(closure, connection))
-		return -1;
-
-	buffer_size = buffer_size_for_closure(closure);
-	buffer = malloc(buffer_size * sizeof buffer[0]);
-	if (buffer == NULL)
-		return -1;
-
-	size = serialize_closure(closure, buffer, buffer_size);
-	if (size < 0) {
-		free(buffer);
-		return -1;
-	}
-
-	result = wl_connection_queue(connection, buffer, size);
-	free(buffer);
+	return serialize_and_write(closure, connection, wl_connection_write);
+}
 
-	return result;
+int
+wl_closure_queue(struct wl_closure *closure, struct wl_connection *connection)
+{
+	return serialize_and_write(closure, connection, wl_connection_queue);
 }
 
 void
 wl_closure_print(struct wl_closure *closure, struct wl_object *target, int send)
 {
 	int i;
-	struct argument_details arg;
-	const char *signature = closure->message->signature;
 	struct timespec tp;
 	unsigned int time;
 
@@ -1194,11 +2015,10 @@ wl_closure_print(struct wl_closure *closure, struct wl_object *target, int send)
 		closure->message->name);
 
 	for (i = 0; i < closure->count; i++) {
-		signature = get_next_argument(signature, &arg);
 		if (i > 0)
 			fprintf(stderr, ", ");
 
-		switch (arg.type) {
+		switch (closure->desc->types[i]) {
 		case 'u':
 			fprintf(stderr, "%u", closure->args[i].u);
 			break;
@@ -1245,5 +2065,8 @@ wl_closure_print(struct wl_closure *closure, struct wl_object *target, int send)
 void
 wl_closure_destroy(struct wl_closure *closure)
 {
-	free(closure);
+	if (closure && closure->pool)
+		wl_closure_pool_free(closure->pool, closure);
+	else
+		free(closure);
 }
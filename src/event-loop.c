@@ -40,6 +40,18 @@
 #ifdef HAVE_SYS_TIMERFD_H
 #include <sys/timerfd.h>
 #endif /* timerfd */
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+/* Waiting with a timeout needs EXT_ARG (Linux 5.11) and edge-triggered
+ * sources need multishot poll (5.13); older headers get epoll only. */
+#if defined(IORING_FEAT_EXT_ARG) && defined(IORING_POLL_ADD_MULTI)
+#define WL_EVENT_LOOP_IO_URING 1
+#include <endian.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif /* io_uring */
 #elif HAVE_SYS_EVENT_H
 #include <sys/types.h>
 #include <sys/event.h>
@@ -48,17 +60,108 @@
 #error "Unsupported event system. Only epoll and kqueue are supported."
 #endif
 
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
 #include <unistd.h>
 #include <assert.h>
 #include "wayland-private.h"
 #include "wayland-server.h"
 #include "wayland-os.h"
 
+/* Events fetched per epoll_wait()/kevent() call.  Unless a fixed size
+ * is set with wl_event_loop_set_max_events(), the batch follows the
+ * number of registered sources between these bounds. */
+#define WL_EVENT_LOOP_MIN_BATCH	32
+#define WL_EVENT_LOOP_MAX_BATCH	1024
+
+/* Freed one-shot idle sources kept around for reuse */
+#define WL_EVENT_LOOP_MAX_FREE_IDLE	16
+
+#ifdef HAVE_SYS_EPOLL_H
+typedef struct epoll_event wl_event_loop_event_t;
+#elif HAVE_SYS_EVENT_H
+typedef struct kevent wl_event_loop_event_t;
+#endif
+
+#ifdef HAVE_SYS_TIMERFD_H
+struct wl_event_source_timer;
+
+/* All timers of a loop are kept in a binary min-heap ordered by
+ * deadline and share a single timerfd, which is only reprogrammed when
+ * the earliest deadline moves closer. */
+struct wl_timer_heap {
+	struct wl_event_source *source;
+	struct wl_event_source_timer **data;
+	int active, space;
+	uint64_t programmed;
+};
+#endif
+
+#ifdef HAVE_SYS_SIGNALFD_H
+/* All signal sources of a loop share one signalfd, whose mask is the
+ * union of the signals they watch. */
+struct wl_signalfd_set {
+	struct wl_event_source *source;
+	struct wl_list sources;
+	/* Sources already visited while routing a signal. */
+	struct wl_list routed;
+	sigset_t mask;
+};
+#endif
+
+#ifdef WL_EVENT_LOOP_IO_URING
+struct wl_uring;
+#endif
+
+struct wl_event_loop_task {
+	struct wl_event_loop_task *next;
+	wl_event_loop_idle_func_t func;
+	void *data;
+};
+
 struct wl_event_loop {
 	int event_fd;
+#ifdef WL_EVENT_LOOP_IO_URING
+	/* Set when polling through io_uring; event_fd is then the ring. */
+	struct wl_uring *uring;
+#endif
 	struct wl_list check_list;
+	int max_check_passes;
+	int checks_pending;
 	struct wl_list idle_list;
 	struct wl_list destroy_list;
+	struct wl_list free_idle_list;
+	int free_idle_count;
+
+	int source_count;
+	int max_events;
+	wl_event_loop_event_t *batch;
+	int batch_size;
+	struct wl_event_loop_stats stats;
+	int profiling;
+	struct wl_event_loop_profile profile;
+
+	/* Sources with a priority other than the default; while there
+	 * are none, events are dispatched in kernel order. */
+	int prioritized;
+	uint8_t *batch_priority;
+	int batch_priority_size;
+	uint64_t preempt_budget;
+
+#ifdef HAVE_SYS_TIMERFD_H
+	struct wl_timer_heap timers;
+#endif
+#ifdef HAVE_SYS_SIGNALFD_H
+	struct wl_signalfd_set signals;
+#endif
+
+	/* Tasks posted from other threads, most recent first.  Only the
+	 * head is shared; everything else belongs to the loop thread. */
+	struct wl_event_loop_task *posted;
+	struct wl_event_source *post_source;
+	int post_fd[2];
 
 	struct wl_signal destroy_signal;
 };
@@ -79,12 +182,19 @@ struct wl_event_source {
 	struct wl_list link;
 	void *data;
 	int fd;
+#ifdef WL_EVENT_LOOP_IO_URING
+	int slot;
+#endif
+	enum wl_event_source_priority priority;
+	struct wl_event_source_profile profile;
 };
 
 struct wl_event_source_fd {
 	struct wl_event_source base;
 	wl_event_loop_fd_func_t func;
 	int fd;
+	/* Mask currently registered with the kernel */
+	uint32_t mask;
 };
 
 #ifdef HAVE_SYS_EPOLL_H
@@ -133,7 +243,433 @@ struct wl_event_source_interface fd_source_interface = {
 	wl_event_source_fd_dispatch,
 };
 
+#ifdef WL_EVENT_LOOP_IO_URING
+/* Optional io_uring poller, selected with WAYLAND_EVENT_LOOP=io_uring.
+ * Fd sources become poll requests on the ring, and each dispatch
+ * submits everything queued since the last one and waits for
+ * completions in a single io_uring_enter().  Level-triggered sources
+ * use one-shot polls that are re-armed once their callback has run,
+ * so data left unread is reported again like with epoll;
+ * edge-triggered sources use multishot polls. */
+
+#define WL_URING_ENTRIES 256
+/* user_data of requests whose completion we don't care about */
+#define WL_URING_IGNORE ((uint64_t) -1)
+
+/* Poll requests carry a slot index and generation rather than a source
+ * pointer, so completions still in the ring after a source is removed
+ * or updated can be recognized and dropped. */
+struct wl_uring_slot {
+	struct wl_event_source *source;
+	uint32_t generation;
+	uint32_t mask;
+	int armed;
+	int next_free;
+};
+
+struct wl_uring {
+	int fd;
+	/* Submit requests as soon as they're queued; set once the ring fd
+	 * is handed out to be polled by someone else. */
+	int eager;
+
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	uint32_t *sq_head, *sq_tail;
+	uint32_t sq_mask, sq_entries, sq_local_tail;
+	uint32_t *cq_head, *cq_tail;
+	uint32_t cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct wl_uring_slot *slots;
+	int slot_count;
+	int free_slot;
+};
+
+static void
+wl_uring_destroy(struct wl_uring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	free(ring->slots);
+	free(ring);
+}
+
+static void *
+wl_uring_map(int fd, size_t size, off_t offset)
+{
+	void *p;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_POPULATE, fd, offset);
+
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static struct wl_uring *
+wl_uring_create(void)
+{
+	struct io_uring_params params;
+	struct wl_uring *ring;
+	uint32_t *sq_array, i;
+	char *sq, *cq;
+
+	ring = malloc(sizeof *ring);
+	if (ring == NULL)
+		return NULL;
+
+	memset(ring, 0, sizeof *ring);
+	ring->free_slot = -1;
+
+	memset(&params, 0, sizeof params);
+	ring->fd = syscall(__NR_io_uring_setup, WL_URING_ENTRIES, &params);
+	if (ring->fd < 0) {
+		free(ring);
+		return NULL;
+	}
+
+	if (!(params.features & IORING_FEAT_EXT_ARG) ||
+	    !(params.features & IORING_FEAT_NODROP))
+		goto err;
+
+	ring->sq_ring_size = params.sq_off.array +
+		params.sq_entries * sizeof(uint32_t);
+	ring->cq_ring_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring = wl_uring_map(ring->fd, ring->sq_ring_size,
+				     IORING_OFF_SQ_RING);
+	if (ring->sq_ring == NULL)
+		goto err;
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cq_ring = ring->sq_ring;
+	else
+		ring->cq_ring = wl_uring_map(ring->fd, ring->cq_ring_size,
+					     IORING_OFF_CQ_RING);
+	if (ring->cq_ring == NULL)
+		goto err;
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = wl_uring_map(ring->fd, ring->sqes_size, IORING_OFF_SQES);
+	if (ring->sqes == NULL)
+		goto err;
+
+	sq = ring->sq_ring;
+	ring->sq_head = (uint32_t *) (sq + params.sq_off.head);
+	ring->sq_tail = (uint32_t *) (sq + params.sq_off.tail);
+	ring->sq_mask = *(uint32_t *) (sq + params.sq_off.ring_mask);
+	ring->sq_entries = params.sq_entries;
+	ring->sq_local_tail = *ring->sq_tail;
+
+	/* Submission slots are always used in ring order. */
+	sq_array = (uint32_t *) (sq + params.sq_off.array);
+	for (i = 0; i < params.sq_entries; i++)
+		sq_array[i] = i;
+
+	cq = ring->cq_ring;
+	ring->cq_head = (uint32_t *) (cq + params.cq_off.head);
+	ring->cq_tail = (uint32_t *) (cq + params.cq_off.tail);
+	ring->cq_mask = *(uint32_t *) (cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+	return ring;
+
+err:
+	wl_uring_destroy(ring);
+	return NULL;
+}
+
+/* Submit queued requests, and if wait is set block until a completion
+ * arrives or timeout milliseconds pass. */
+static int
+wl_uring_enter(struct wl_uring *ring, int wait, int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int pending, flags;
+	int ret;
+
+	pending = ring->sq_local_tail -
+		__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (pending == 0 && !wait)
+		return 0;
+
+	memset(&arg, 0, sizeof arg);
+	flags = IORING_ENTER_EXT_ARG;
+	if (wait) {
+		flags |= IORING_ENTER_GETEVENTS;
+		if (timeout >= 0) {
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = (timeout % 1000) * 1000000;
+			arg.ts = (uint64_t) (uintptr_t) &ts;
+		}
+	}
+
+	ret = syscall(__NR_io_uring_enter, ring->fd, pending, wait ? 1 : 0,
+		      flags, &arg, sizeof arg);
+	if (ret < 0 && errno == ETIME)
+		return 0;
+
+	return ret < 0 ? -1 : 0;
+}
+
+static struct io_uring_sqe *
+wl_uring_get_sqe(struct wl_uring *ring)
+{
+	struct io_uring_sqe *sqe;
+	uint32_t head;
+
+	head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (ring->sq_local_tail - head >= ring->sq_entries) {
+		if (wl_uring_enter(ring, 0, 0) < 0)
+			return NULL;
+		head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		if (ring->sq_local_tail - head >= ring->sq_entries) {
+			errno = EBUSY;
+			return NULL;
+		}
+	}
+
+	sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask];
+	memset(sqe, 0, sizeof *sqe);
+
+	return sqe;
+}
+
+static int
+wl_uring_queue(struct wl_uring *ring)
+{
+	ring->sq_local_tail++;
+	__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+	if (ring->eager)
+		return wl_uring_enter(ring, 0, 0);
+
+	return 0;
+}
+
+static uint64_t
+wl_uring_user_data(struct wl_uring *ring, int index)
+{
+	return (uint64_t) ring->slots[index].generation << 32 | index;
+}
+
+static int
+wl_uring_arm(struct wl_uring *ring, int index)
+{
+	struct wl_uring_slot *slot = &ring->slots[index];
+	struct io_uring_sqe *sqe;
+	uint32_t events = 0;
+
+	sqe = wl_uring_get_sqe(ring);
+	if (sqe == NULL)
+		return -1;
+
+	if (slot->mask & WL_EVENT_READABLE)
+		events |= POLLIN;
+	if (slot->mask & WL_EVENT_WRITABLE)
+		events |= POLLOUT;
+#if __BYTE_ORDER == __BIG_ENDIAN
+	events = events << 16 | events >> 16;
+#endif
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = slot->source->fd;
+	sqe->poll32_events = events;
+	if (slot->mask & WL_EVENT_EDGE_TRIGGERED)
+		sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = wl_uring_user_data(ring, index);
+	slot->armed = 1;
+
+	return wl_uring_queue(ring);
+}
+
+static int
+wl_uring_disarm(struct wl_uring *ring, int index)
+{
+	struct wl_uring_slot *slot = &ring->slots[index];
+	struct io_uring_sqe *sqe;
+	uint64_t user_data = wl_uring_user_data(ring, index);
+
+	/* Completions already posted for the old request are stale. */
+	slot->generation++;
+	if (!slot->armed)
+		return 0;
+
+	sqe = wl_uring_get_sqe(ring);
+	if (sqe == NULL)
+		return -1;
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = user_data;
+	sqe->user_data = WL_URING_IGNORE;
+	slot->armed = 0;
+
+	return wl_uring_queue(ring);
+}
+
+static int
+wl_uring_add(struct wl_uring *ring, struct wl_event_source *source,
+	     uint32_t mask)
+{
+	struct wl_uring_slot *slots;
+	int i, index, count;
+
+	if (ring->free_slot < 0) {
+		count = ring->slot_count ? ring->slot_count * 2 : 16;
+		slots = realloc(ring->slots, count * sizeof *slots);
+		if (slots == NULL)
+			return -1;
+
+		for (i = ring->slot_count; i < count; i++) {
+			slots[i].source = NULL;
+			slots[i].generation = 0;
+			slots[i].armed = 0;
+			slots[i].next_free = i + 1 < count ? i + 1 : -1;
+		}
+		ring->slots = slots;
+		ring->free_slot = ring->slot_count;
+		ring->slot_count = count;
+	}
+
+	index = ring->free_slot;
+	ring->free_slot = ring->slots[index].next_free;
+	ring->slots[index].source = source;
+	ring->slots[index].mask = mask;
+	source->slot = index;
+
+	if (wl_uring_arm(ring, index) < 0) {
+		ring->slots[index].source = NULL;
+		ring->slots[index].next_free = ring->free_slot;
+		ring->free_slot = index;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+wl_uring_update(struct wl_uring *ring, struct wl_event_source *source,
+		uint32_t mask)
+{
+	if (wl_uring_disarm(ring, source->slot) < 0)
+		return -1;
+
+	ring->slots[source->slot].mask = mask;
+
+	return wl_uring_arm(ring, source->slot);
+}
+
+static void
+wl_uring_remove(struct wl_uring *ring, struct wl_event_source *source)
+{
+	struct wl_uring_slot *slot = &ring->slots[source->slot];
+
+	wl_uring_disarm(ring, source->slot);
+	slot->source = NULL;
+	slot->next_free = ring->free_slot;
+	ring->free_slot = source->slot;
+
+	/* Let the kernel drop its reference to the file now; the caller
+	 * is about to close the fd. */
+	wl_uring_enter(ring, 0, 0);
+}
+
+/* Turn up to size completions into epoll events, submitting pending
+ * requests and waiting only if there are none to collect yet. */
+static int
+wl_uring_wait(struct wl_uring *ring, struct epoll_event *ep, int size,
+	      int timeout)
+{
+	struct io_uring_cqe *cqe;
+	struct wl_uring_slot *slot;
+	uint32_t head, tail, index;
+	int count = 0, ret;
+
+	head = *ring->cq_head;
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	ret = wl_uring_enter(ring, head == tail, timeout);
+	if (ret < 0)
+		return -1;
+
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail && count < size) {
+		cqe = &ring->cqes[head & ring->cq_mask];
+		head++;
+
+		if (cqe->user_data == WL_URING_IGNORE)
+			continue;
+
+		index = (uint32_t) cqe->user_data;
+		if (index >= (uint32_t) ring->slot_count)
+			continue;
+		slot = &ring->slots[index];
+		if (slot->source == NULL ||
+		    slot->generation != cqe->user_data >> 32)
+			continue;
+
+		if (!(cqe->flags & IORING_CQE_F_MORE))
+			slot->armed = 0;
+
+		/* Poll and epoll event bits are the same. */
+		ep[count].events = cqe->res < 0 ? EPOLLERR : cqe->res;
+		ep[count].data.ptr = slot->source;
+		count++;
+	}
+
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+	return count;
+}
+
+/* Re-arm the one-shot polls that completed, after their sources had a
+ * chance to consume what was pending.  The requests go out with the
+ * next wait. */
+static void
+wl_uring_rearm(struct wl_uring *ring, struct epoll_event *ep, int count)
+{
+	struct wl_event_source *source;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		source = ep[i].data.ptr;
+		if (source->fd != -1 && !ring->slots[source->slot].armed)
+			wl_uring_arm(ring, source->slot);
+	}
+}
+#endif
+
 #ifdef HAVE_SYS_EPOLL_H
+static uint32_t
+epoll_events_for_mask(uint32_t mask)
+{
+	uint32_t events = 0;
+
+	if (mask & WL_EVENT_READABLE)
+		events |= EPOLLIN;
+	if (mask & WL_EVENT_WRITABLE)
+		events |= EPOLLOUT;
+	if (mask & WL_EVENT_EDGE_TRIGGERED)
+		events |= EPOLLET;
+
+	return events;
+}
+
 static struct wl_event_source *
 add_source(struct wl_event_loop *loop,
 	   struct wl_event_source *source, uint32_t mask, void *data)
@@ -148,20 +684,35 @@ add_source(struct wl_event_loop *loop,
 	source->loop = loop;
 	source->data = data;
 	wl_list_init(&source->link);
+	source->priority = WL_EVENT_SOURCE_PRIORITY_DEFAULT;
+	memset(&source->profile, 0, sizeof source->profile);
+
+#ifdef WL_EVENT_LOOP_IO_URING
+	if (loop->uring) {
+		if (wl_uring_add(loop->uring, source, mask) < 0) {
+			close(source->fd);
+			free(source);
+			return NULL;
+		}
+
+		loop->source_count++;
+
+		return source;
+	}
+#endif
 
 	memset(&ep, 0, sizeof ep);
-	if (mask & WL_EVENT_READABLE)
-		ep.events |= EPOLLIN;
-	if (mask & WL_EVENT_WRITABLE)
-		ep.events |= EPOLLOUT;
+	ep.events = epoll_events_for_mask(mask);
 	ep.data.ptr = source;
 
-	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, source->fd, &ep) < 0) {
+	if (epoll_ctl(loop->event_fd, EPOLL_CTL_ADD, source->fd, &ep) < 0) {
 		close(source->fd);
 		free(source);
 		return NULL;
 	}
 
+	loop->source_count++;
+
 	return source;
 }
 #elif HAVE_SYS_EVENT_H
@@ -171,6 +722,7 @@ add_source(struct wl_event_loop *loop,
 {
 	struct kevent events[2];
        unsigned int num_events = 0;
+       uint16_t flags = EV_ADD | EV_ENABLE;
 
        if (source->fd < 0) {
                fprintf(stderr, "could not add source\n: %m");
@@ -181,16 +733,21 @@ add_source(struct wl_event_loop *loop,
        source->loop = loop;
        source->data = data;
        wl_list_init(&source->link);
+       source->priority = WL_EVENT_SOURCE_PRIORITY_DEFAULT;
+       memset(&source->profile, 0, sizeof source->profile);
+
+       if (mask & WL_EVENT_EDGE_TRIGGERED)
+               flags |= EV_CLEAR;
 
        if (mask & WL_EVENT_READABLE) {
                EV_SET(&events[num_events], source->fd, EVFILT_READ,
-                      EV_ADD | EV_ENABLE, 0, 0, source);
+                      flags, 0, 0, source);
                num_events++;
        }
 
        if (mask & WL_EVENT_WRITABLE) {
                EV_SET(&events[num_events], source->fd, EVFILT_WRITE,
-                      EV_ADD | EV_ENABLE, 0, 0, source);
+                      flags, 0, 0, source);
                num_events++;
        }
 
@@ -202,6 +759,8 @@ add_source(struct wl_event_loop *loop,
                return NULL;
        }
 
+       loop->source_count++;
+
        return source;
 }
 #endif
@@ -222,55 +781,218 @@ wl_event_loop_add_fd(struct wl_event_loop *loop,
 	source->base.fd = wl_os_dupfd_cloexec(fd, 0);
 	source->func = func;
 	source->fd = fd;
+	source->mask = mask & (WL_EVENT_READABLE | WL_EVENT_WRITABLE |
+			       WL_EVENT_EDGE_TRIGGERED);
 
-	return add_source(loop, &source->base, mask, data);
+	return add_source(loop, &source->base, source->mask, data);
+}
+
+/* Merge the source's trigger mode into a new mask, and tell whether it
+ * differs from what the kernel already has. */
+static int
+fd_source_mask_changed(struct wl_event_source_fd *fd_source, uint32_t *mask)
+{
+	struct wl_event_loop *loop = fd_source->base.loop;
+
+	*mask &= WL_EVENT_READABLE | WL_EVENT_WRITABLE;
+	*mask |= fd_source->mask & WL_EVENT_EDGE_TRIGGERED;
+
+	if (*mask == fd_source->mask) {
+		loop->stats.fd_updates_skipped++;
+		return 0;
+	}
+
+	loop->stats.fd_updates++;
+
+	return 1;
 }
 
 #ifdef HAVE_SYS_EPOLL_H
 WL_EXPORT int
 wl_event_source_fd_update(struct wl_event_source *source, uint32_t mask)
 {
+	struct wl_event_source_fd *fd_source =
+		(struct wl_event_source_fd *) source;
 	struct wl_event_loop *loop = source->loop;
 	struct epoll_event ep;
 
+	if (!fd_source_mask_changed(fd_source, &mask))
+		return 0;
+
+#ifdef WL_EVENT_LOOP_IO_URING
+	if (loop->uring) {
+		if (wl_uring_update(loop->uring, source, mask) < 0)
+			return -1;
+
+		fd_source->mask = mask;
+
+		return 0;
+	}
+#endif
+
 	memset(&ep, 0, sizeof ep);
-	if (mask & WL_EVENT_READABLE)
-		ep.events |= EPOLLIN;
-	if (mask & WL_EVENT_WRITABLE)
-		ep.events |= EPOLLOUT;
+	ep.events = epoll_events_for_mask(mask);
 	ep.data.ptr = source;
 
-	return epoll_ctl(loop->event_fd, EPOLL_CTL_MOD, source->fd, &ep);
+	if (epoll_ctl(loop->event_fd, EPOLL_CTL_MOD, source->fd, &ep) < 0)
+		return -1;
+
+	fd_source->mask = mask;
+
+	return 0;
 }
 #elif HAVE_SYS_EVENT_H
 WL_EXPORT int
 wl_event_source_fd_update(struct wl_event_source *source, uint32_t mask)
 {
+       struct wl_event_source_fd *fd_source =
+               (struct wl_event_source_fd *) source;
        struct wl_event_loop *loop = source->loop;
        struct kevent events[2];
        unsigned int num_events = 0;
+       uint16_t flags = EV_ADD | EV_ENABLE;
 
+       if (!fd_source_mask_changed(fd_source, &mask))
+               return 0;
+
+       if (mask & WL_EVENT_EDGE_TRIGGERED)
+               flags |= EV_CLEAR;
+
+       /* Knowing the old mask lets us drop filters that are no longer
+        * wanted instead of leaving them registered. */
        if (mask & WL_EVENT_READABLE) {
-       EV_SET(&events[num_events], source->fd, EVFILT_READ,
-                      EV_ADD | EV_ENABLE, 0, 0, source);
+               EV_SET(&events[num_events], source->fd, EVFILT_READ,
+                      flags, 0, 0, source);
+               num_events++;
+       } else if (fd_source->mask & WL_EVENT_READABLE) {
+               EV_SET(&events[num_events], source->fd, EVFILT_READ,
+                      EV_DELETE, 0, 0, source);
                num_events++;
        }
 
        if (mask & WL_EVENT_WRITABLE) {
                EV_SET(&events[num_events], source->fd, EVFILT_WRITE,
-                      EV_ADD | EV_ENABLE, 0, 0, source);
+                      flags, 0, 0, source);
+               num_events++;
+       } else if (fd_source->mask & WL_EVENT_WRITABLE) {
+               EV_SET(&events[num_events], source->fd, EVFILT_WRITE,
+                      EV_DELETE, 0, 0, source);
                num_events++;
        }
 
-       return kevent(loop->event_fd, events, num_events, NULL, 0, NULL);
+       if (kevent(loop->event_fd, events, num_events, NULL, 0, NULL) < 0)
+               return -1;
+
+       fd_source->mask = mask;
+
+       return 0;
 }
 #endif
 
 struct wl_event_source_timer {
 	struct wl_event_source base;
 	wl_event_loop_timer_func_t func;
+	wl_event_loop_timer_deadline_func_t deadline_func;
+	/* All times are CLOCK_MONOTONIC nanoseconds.  The timer may fire
+	 * anywhere between deadline and deadline + slack. */
+	uint64_t deadline;
+	uint64_t slack;
+	uint64_t interval;
+	uint64_t expirations;
+#ifdef HAVE_SYS_TIMERFD_H
+	int heap_index;
+	/* On the heap dispatch's expired list while waiting to run.  Kept
+	 * apart from base.link, which wl_event_source_check() may use. */
+	struct wl_list expired_link;
+#endif
 };
 
+static uint64_t
+timer_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Record one callback that ran from start to end. */
+static uint64_t
+wl_event_source_account(struct wl_event_source *source,
+			uint64_t start, uint64_t end)
+{
+	struct wl_event_source_profile *profile = &source->profile;
+	uint64_t duration = end - start, limit = 16000;
+	int bucket = 0;
+
+	profile->dispatches++;
+	profile->total_ns += duration;
+	if (duration > profile->max_ns)
+		profile->max_ns = duration;
+
+	while (bucket < WL_EVENT_SOURCE_PROFILE_BUCKETS - 1 &&
+	       duration >= limit) {
+		limit <<= 2;
+		bucket++;
+	}
+	profile->histogram[bucket]++;
+
+	return duration;
+}
+
+/* For periodic timers, advance the deadline past now and return how
+ * many periods expired; one-shot timers always expire once. */
+static uint64_t
+wl_event_source_timer_advance(struct wl_event_source_timer *timer,
+			      uint64_t now)
+{
+	uint64_t expirations = 1;
+
+	if (timer->interval == 0)
+		return 1;
+
+	if (now > timer->deadline)
+		expirations += (now - timer->deadline) / timer->interval;
+	timer->deadline += expirations * timer->interval;
+
+	return expirations;
+}
+
+static int
+wl_event_source_timer_fire(struct wl_event_source_timer *timer,
+			   uint64_t expirations)
+{
+	if (timer->deadline_func)
+		return timer->deadline_func(expirations, timer->base.data);
+
+	return timer->func(timer->base.data);
+}
+
+#if !defined(HAVE_SYS_TIMERFD_H) && defined(HAVE_SYS_EVENT_H)
+static int
+wl_timer_kevent_arm(struct wl_event_source_timer *timer)
+{
+       struct kevent ev;
+       uint64_t now = timer_now();
+       intptr_t delay = 0;
+
+       /* kqueue timers take a relative delay in milliseconds. */
+       if (timer->deadline > now)
+               delay = (timer->deadline - now + 999999) / 1000000;
+
+       EV_SET(&ev, 0, EVFILT_TIMER, EV_ADD | EV_ENABLE | EV_ONESHOT, 0,
+              delay, timer);
+
+       if (kevent(timer->base.loop->event_fd, &ev, 1, NULL, 0, NULL) < 0) {
+               fprintf(stderr, "could not set kqueue timer\n: %m");
+               return -1;
+       }
+
+       return 0;
+}
+#endif
+
 #ifdef HAVE_SYS_EPOLL_H
 static int
 wl_event_source_timer_dispatch(struct wl_event_source *source,
@@ -285,29 +1007,248 @@ wl_event_source_timer_dispatch(struct wl_event_source *source,
 		(struct wl_event_source_timer *) source;
 	uint64_t expires;
 #ifdef HAVE_SYS_TIMERFD_H
-	int len;
+	/* Linux.  Timers share the loop's timerfd and are normally run
+	 * from wl_timer_heap_dispatch(); we only get here through
+	 * wl_event_source_check(). */
+	expires = 1;
+#else
+	/* FreeBSD.  kqueue timers are one-shot; re-arm periodic ones. */
+	expires = wl_event_source_timer_advance(timer_source, timer_now());
+	if (timer_source->interval)
+		wl_timer_kevent_arm(timer_source);
+#endif
+
+	return wl_event_source_timer_fire(timer_source, expires);
+}
+
+struct wl_event_source_interface timer_source_interface = {
+	wl_event_source_timer_dispatch,
+};
+
+#ifdef HAVE_SYS_TIMERFD_H
+/* The heap is ordered by the latest time each timer may fire,
+ * deadline + slack.  That saturates, so a huge slack can't wrap around
+ * and make the timer due before its deadline. */
+static inline uint64_t
+timer_latest(const struct wl_event_source_timer *timer)
+{
+	if (timer->slack > UINT64_MAX - timer->deadline)
+		return UINT64_MAX;
+
+	return timer->deadline + timer->slack;
+}
+
+static void
+wl_timer_heap_set(struct wl_timer_heap *heap, int i,
+		  struct wl_event_source_timer *timer)
+{
+	heap->data[i] = timer;
+	timer->heap_index = i;
+}
+
+static void
+wl_timer_heap_sift_up(struct wl_timer_heap *heap, int i)
+{
+	struct wl_event_source_timer *timer = heap->data[i];
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (timer_latest(heap->data[parent]) <= timer_latest(timer))
+			break;
+		wl_timer_heap_set(heap, i, heap->data[parent]);
+		i = parent;
+	}
+
+	wl_timer_heap_set(heap, i, timer);
+}
+
+static void
+wl_timer_heap_sift_down(struct wl_timer_heap *heap, int i)
+{
+	struct wl_event_source_timer *timer = heap->data[i];
+	int child;
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= heap->active)
+			break;
+		if (child + 1 < heap->active &&
+		    timer_latest(heap->data[child + 1]) <
+		    timer_latest(heap->data[child]))
+			child++;
+		if (timer_latest(timer) <= timer_latest(heap->data[child]))
+			break;
+		wl_timer_heap_set(heap, i, heap->data[child]);
+		i = child;
+	}
+
+	wl_timer_heap_set(heap, i, timer);
+}
+
+static int
+wl_timer_heap_insert(struct wl_timer_heap *heap,
+		     struct wl_event_source_timer *timer)
+{
+	struct wl_event_source_timer **data;
+	int space;
+
+	if (heap->active == heap->space) {
+		space = heap->space ? heap->space * 2 : 16;
+		data = realloc(heap->data, space * sizeof *data);
+		if (data == NULL)
+			return -1;
+		heap->data = data;
+		heap->space = space;
+	}
+
+	wl_timer_heap_set(heap, heap->active++, timer);
+	wl_timer_heap_sift_up(heap, timer->heap_index);
+
+	return 0;
+}
+
+static void
+wl_timer_heap_remove(struct wl_timer_heap *heap,
+		     struct wl_event_source_timer *timer)
+{
+	int i = timer->heap_index;
+	struct wl_event_source_timer *last;
+
+	timer->heap_index = -1;
+	last = heap->data[--heap->active];
+	if (last == timer)
+		return;
+
+	wl_timer_heap_set(heap, i, last);
+	if (i > 0 && timer_latest(heap->data[(i - 1) / 2]) > timer_latest(last))
+		wl_timer_heap_sift_up(heap, i);
+	else
+		wl_timer_heap_sift_down(heap, i);
+}
+
+/* Make sure the timerfd fires no later than the earliest time any timer
+ * must fire.  A timerfd set for a timer that has since been removed or
+ * pushed back only causes a spurious wakeup, after which it is
+ * reprogrammed. */
+static int
+wl_timer_heap_program(struct wl_timer_heap *heap)
+{
+	struct itimerspec its;
+	uint64_t deadline;
+
+	if (heap->active == 0)
+		return 0;
+
+	deadline = timer_latest(heap->data[0]);
+	if (heap->programmed != 0 && heap->programmed <= deadline)
+		return 0;
+
+	its.it_interval.tv_sec = 0;
+	its.it_interval.tv_nsec = 0;
+	its.it_value.tv_sec = deadline / 1000000000;
+	its.it_value.tv_nsec = deadline % 1000000000;
+	if (timerfd_settime(heap->source->fd, TFD_TIMER_ABSTIME,
+			    &its, NULL) < 0)
+		return -1;
+
+	heap->programmed = deadline;
+
+	return 0;
+}
+
+static int
+wl_timer_heap_dispatch(struct wl_event_source *source,
+		       struct epoll_event *ep)
+{
+	struct wl_timer_heap *heap = &source->loop->timers;
+	struct wl_event_source_timer *timer;
+	struct wl_list expired;
+	uint64_t expires, now;
+	int len, n = 0;
 
-	/* Linux. Read the number of missed expirations from the FD. */
 	len = read(source->fd, &expires, sizeof expires);
 	if (!(len == -1 && errno == EAGAIN) && len != sizeof expires)
 		/* Is there anything we can do here?  Will this ever happen? */
 		wl_log("timerfd read error: %m\n");
-#else
-	/* FreeBSD. Grab the number of missed expires from the kevent. */
-	expires = ev->data;
-#endif
 
-	return timer_source->func(timer_source->base.data);
+	heap->programmed = 0;
+
+	/* Collect everything that has expired before running any
+	 * callback, so that a callback re-arming another expired timer
+	 * doesn't postpone it.  Removing a timer takes it off the
+	 * expired list.  Timers whose
+	 * slack window has opened are run along with the ones that must
+	 * fire now, as long as they are next in line. */
+	wl_list_init(&expired);
+	now = timer_now();
+	while (heap->active > 0 &&
+	       (timer_latest(heap->data[0]) <= now ||
+		heap->data[0]->deadline <= now)) {
+		timer = heap->data[0];
+		wl_timer_heap_remove(heap, timer);
+		timer->expirations = wl_event_source_timer_advance(timer, now);
+		if (timer->interval && wl_timer_heap_insert(heap, timer) < 0)
+			wl_log("failed to re-arm periodic timer\n");
+		wl_list_insert(expired.prev, &timer->expired_link);
+	}
+
+	while (!wl_list_empty(&expired)) {
+		timer = container_of(expired.next,
+				     struct wl_event_source_timer, expired_link);
+		wl_list_remove(&timer->expired_link);
+		wl_list_init(&timer->expired_link);
+		if (source->loop->profiling) {
+			now = timer_now();
+			n += wl_event_source_timer_fire(timer,
+							timer->expirations);
+			wl_event_source_account(&timer->base, now,
+						timer_now());
+		} else {
+			n += wl_event_source_timer_fire(timer,
+							timer->expirations);
+		}
+	}
+
+	if (wl_timer_heap_program(heap) < 0)
+		wl_log("timerfd settime error: %m\n");
+
+	return n;
 }
 
-struct wl_event_source_interface timer_source_interface = {
-	wl_event_source_timer_dispatch,
+struct wl_event_source_interface timer_heap_source_interface = {
+	wl_timer_heap_dispatch,
 };
 
-WL_EXPORT struct wl_event_source *
-wl_event_loop_add_timer(struct wl_event_loop *loop,
-			wl_event_loop_timer_func_t func,
-			void *data)
+static int
+wl_timer_heap_ensure_source(struct wl_event_loop *loop)
+{
+	struct wl_event_source *source;
+
+	if (loop->timers.source)
+		return 0;
+
+	source = malloc(sizeof *source);
+	if (source == NULL)
+		return -1;
+
+	source->interface = &timer_heap_source_interface;
+	source->fd = timerfd_create(CLOCK_MONOTONIC,
+				    TFD_CLOEXEC | TFD_NONBLOCK);
+
+	loop->timers.source = add_source(loop, source, WL_EVENT_READABLE, NULL);
+	if (loop->timers.source == NULL)
+		return -1;
+
+	return 0;
+}
+#endif
+
+static struct wl_event_source *
+timer_source_create(struct wl_event_loop *loop,
+		    wl_event_loop_timer_func_t func,
+		    wl_event_loop_timer_deadline_func_t deadline_func,
+		    void *data)
 {
 	struct wl_event_source_timer *source;
 
@@ -317,11 +1258,27 @@ wl_event_loop_add_timer(struct wl_event_loop *loop,
 
 	source->base.interface = &timer_source_interface;
 	source->func = func;
+	source->deadline_func = deadline_func;
+	source->deadline = 0;
+	source->slack = 0;
+	source->interval = 0;
+	source->expirations = 0;
+	source->base.priority = WL_EVENT_SOURCE_PRIORITY_DEFAULT;
+	memset(&source->base.profile, 0, sizeof source->base.profile);
 #ifdef HAVE_SYS_TIMERFD_H
-	source->base.fd = timerfd_create(CLOCK_MONOTONIC,
-					 TFD_CLOEXEC | TFD_NONBLOCK);
+	if (wl_timer_heap_ensure_source(loop) < 0) {
+		free(source);
+		return NULL;
+	}
+
+	source->base.fd = -1;
+	source->base.loop = loop;
+	source->base.data = data;
+	source->heap_index = -1;
+	wl_list_init(&source->base.link);
+	wl_list_init(&source->expired_link);
 
-	return add_source(loop, &source->base, WL_EVENT_READABLE, data);
+	return &source->base;
 #else
        /* FreeBSD. We use kqueue() timers directly.
         * See: wl_event_source_timer_update(). */
@@ -334,68 +1291,282 @@ wl_event_loop_add_timer(struct wl_event_loop *loop,
 #endif
 }
 
-WL_EXPORT int
-wl_event_source_timer_update(struct wl_event_source *source, int ms_delay)
+WL_EXPORT struct wl_event_source *
+wl_event_loop_add_timer(struct wl_event_loop *loop,
+			wl_event_loop_timer_func_t func,
+			void *data)
+{
+	return timer_source_create(loop, func, NULL, data);
+}
+
+/* Like wl_event_loop_add_timer(), but the callback is told how many
+ * times the timer expired since it last ran, which is more than one
+ * when a periodic timer overran. */
+WL_EXPORT struct wl_event_source *
+wl_event_loop_add_timer_deadline(struct wl_event_loop *loop,
+				 wl_event_loop_timer_deadline_func_t func,
+				 void *data)
+{
+	return timer_source_create(loop, NULL, func, data);
+}
+
+static int
+timer_source_arm(struct wl_event_source_timer *timer, uint64_t deadline,
+		 uint64_t slack)
 {
 #ifdef HAVE_SYS_TIMERFD_H
-	/* Linux */
-	struct itimerspec its;
+	struct wl_timer_heap *heap = &timer->base.loop->timers;
 
-	its.it_interval.tv_sec = 0;
-	its.it_interval.tv_nsec = 0;
-	its.it_value.tv_sec = ms_delay / 1000;
-	its.it_value.tv_nsec = (ms_delay % 1000) * 1000 * 1000;
-	if (timerfd_settime(source->fd, 0, &its, NULL) < 0)
+	if (timer->heap_index >= 0)
+		wl_timer_heap_remove(heap, timer);
+
+	timer->deadline = deadline;
+	timer->slack = slack;
+	if (deadline == 0)
+		return 0;
+
+	if (wl_timer_heap_insert(heap, timer) < 0)
 		return -1;
 
-	return 0;
+	return wl_timer_heap_program(heap);
 #else
-        /* FreeBSD. */
        struct kevent ev;
 
-       EV_SET(&ev, 0, EVFILT_TIMER, EV_ADD | EV_ENABLE | EV_ONESHOT, 0,
-              ms_delay, source);
+       timer->deadline = deadline;
+       timer->slack = slack;
+       if (deadline != 0)
+               return wl_timer_kevent_arm(timer);
 
-       if (kevent(source->loop->event_fd, &ev, 1, NULL, 0, NULL) < 0) {
-               fprintf(stderr, "could not set kqueue timer\n: %m");
-               return -1;
-       }
+       EV_SET(&ev, 0, EVFILT_TIMER, EV_DELETE, 0, 0, timer);
+       kevent(timer->base.loop->event_fd, &ev, 1, NULL, 0, NULL);
 
        return 0;
 #endif
 }
 
+WL_EXPORT int
+wl_event_source_timer_update(struct wl_event_source *source, int ms_delay)
+{
+	struct wl_event_source_timer *timer =
+		(struct wl_event_source_timer *) source;
+
+	if (ms_delay < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (ms_delay == 0)
+		return timer_source_arm(timer, 0, 0);
+
+	return timer_source_arm(timer,
+				timer_now() + (uint64_t) ms_delay * 1000000, 0);
+}
+
+/* Arm the timer to fire at an absolute CLOCK_MONOTONIC time, or disarm
+ * it if deadline is NULL.  The timer may fire up to slack_ns late, which
+ * lets the loop serve nearby timers with a single wakeup. */
+WL_EXPORT int
+wl_event_source_timer_set_deadline(struct wl_event_source *source,
+				   const struct timespec *deadline,
+				   uint64_t slack_ns)
+{
+	struct wl_event_source_timer *timer =
+		(struct wl_event_source_timer *) source;
+	uint64_t ns;
+
+	if (deadline == NULL)
+		return timer_source_arm(timer, 0, 0);
+
+	if (deadline->tv_sec < 0 || deadline->tv_nsec < 0 ||
+	    deadline->tv_nsec >= 1000000000) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	ns = (uint64_t) deadline->tv_sec * 1000000000 + deadline->tv_nsec;
+
+	/* Zero means disarmed internally; it's in the past anyway. */
+	return timer_source_arm(timer, ns ? ns : 1, slack_ns);
+}
+
+/* Make the timer periodic: after it expires it is re-armed interval_ns
+ * after its previous deadline.  Zero makes it one-shot again. */
+WL_EXPORT int
+wl_event_source_timer_set_interval(struct wl_event_source *source,
+				   uint64_t interval_ns)
+{
+	struct wl_event_source_timer *timer =
+		(struct wl_event_source_timer *) source;
+
+	timer->interval = interval_ns;
+
+	return 0;
+}
+
 struct wl_event_source_signal {
 	struct wl_event_source base;
 	int signal_number;
 	wl_event_loop_signal_func_t func;
+#ifdef HAVE_SYS_SIGNALFD_H
+	/* On the loop's signalfd set.  Kept apart from base.link, which
+	 * wl_event_source_check() may use. */
+	struct wl_list signal_link;
+#endif
 };
 
-#ifdef HAVE_SYS_EPOLL_H
+static void
+source_set_priority(struct wl_event_source *source,
+		    enum wl_event_source_priority priority)
+{
+	struct wl_event_loop *loop = source->loop;
+
+	if (source->priority != WL_EVENT_SOURCE_PRIORITY_DEFAULT)
+		loop->prioritized--;
+	if (priority != WL_EVENT_SOURCE_PRIORITY_DEFAULT)
+		loop->prioritized++;
+	source->priority = priority;
+}
+
+#ifdef HAVE_SYS_SIGNALFD_H
+/* Call every source watching signal_number.  Sources are moved to the
+ * routed list as they are visited, so callbacks can remove any of them. */
+static int
+wl_signalfd_route(struct wl_event_loop *loop, int signal_number)
+{
+	struct wl_event_source_signal *source;
+	uint64_t start;
+	int n = 0;
+
+	while (!wl_list_empty(&loop->signals.sources)) {
+		source = container_of(loop->signals.sources.next,
+				      struct wl_event_source_signal, signal_link);
+		wl_list_remove(&source->signal_link);
+		wl_list_insert(loop->signals.routed.prev, &source->signal_link);
+		if (source->signal_number != signal_number)
+			continue;
+
+		start = loop->profiling ? timer_now() : 0;
+		n += source->func(signal_number, source->base.data);
+		if (loop->profiling)
+			wl_event_source_account(&source->base, start,
+						timer_now());
+	}
+	wl_list_insert_list(&loop->signals.sources, &loop->signals.routed);
+	wl_list_init(&loop->signals.routed);
+
+	return n;
+}
+
+static int
+wl_signalfd_dispatch(struct wl_event_source *source,
+		     struct epoll_event *ep)
+{
+	struct wl_event_loop *loop = source->loop;
+	struct signalfd_siginfo info[16];
+	int len, i, n = 0;
+
+	/* A burst of signals is drained with as few reads as possible. */
+	do {
+		len = read(source->fd, info, sizeof info);
+		if (len < 0) {
+			if (errno != EAGAIN)
+				wl_log("signalfd read error: %m\n");
+			break;
+		}
+
+		for (i = 0; i < len / (int) sizeof info[0]; i++)
+			n += wl_signalfd_route(loop, info[i].ssi_signo);
+	} while (len == sizeof info);
+
+	return n;
+}
+
+struct wl_event_source_interface signalfd_source_interface = {
+	wl_signalfd_dispatch,
+};
+
+/* Point the shared signalfd at the signals still being watched, and
+ * give it the highest priority of the sources watching them. */
+static int
+wl_signalfd_update(struct wl_event_loop *loop)
+{
+	struct wl_event_source_signal *source;
+	enum wl_event_source_priority priority =
+		WL_EVENT_SOURCE_PRIORITY_COUNT;
+
+	sigemptyset(&loop->signals.mask);
+	wl_list_for_each(source, &loop->signals.sources, signal_link) {
+		sigaddset(&loop->signals.mask, source->signal_number);
+		if (source->base.priority < priority)
+			priority = source->base.priority;
+	}
+	wl_list_for_each(source, &loop->signals.routed, signal_link) {
+		sigaddset(&loop->signals.mask, source->signal_number);
+		if (source->base.priority < priority)
+			priority = source->base.priority;
+	}
+
+	if (priority == WL_EVENT_SOURCE_PRIORITY_COUNT)
+		priority = WL_EVENT_SOURCE_PRIORITY_DEFAULT;
+	source_set_priority(loop->signals.source, priority);
+
+	if (signalfd(loop->signals.source->fd, &loop->signals.mask, 0) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int
+wl_signalfd_ensure_source(struct wl_event_loop *loop)
+{
+	struct wl_event_source *source;
+	sigset_t mask;
+
+	if (loop->signals.source)
+		return 0;
+
+	source = malloc(sizeof *source);
+	if (source == NULL)
+		return -1;
+
+	sigemptyset(&mask);
+	source->interface = &signalfd_source_interface;
+	source->fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+
+	loop->signals.source = add_source(loop, source, WL_EVENT_READABLE,
+					  NULL);
+	if (loop->signals.source == NULL)
+		return -1;
+
+	return 0;
+}
+#endif
+
+#ifdef HAVE_SYS_SIGNALFD_H
 static int
 wl_event_source_signal_dispatch(struct wl_event_source *source,
 			       struct epoll_event *ep)
+{
+	struct wl_event_source_signal *signal_source =
+		(struct wl_event_source_signal *) source;
+
+	/* Signals are read from the loop's shared signalfd and routed
+	 * from there; we only get here through wl_event_source_check(). */
+	return signal_source->func(signal_source->signal_number,
+				   signal_source->base.data);
+}
 #elif HAVE_SYS_EVENT_H
 static int
 wl_event_source_signal_dispatch(struct wl_event_source *source,
                                struct kevent *ev)
-#endif
 {
 	struct wl_event_source_signal *signal_source =
 		(struct wl_event_source_signal *) source;
-#ifdef HAVE_SYS_SIGNALFD_H
-	struct signalfd_siginfo signal_info;
-	int len;
-
-	len = read(source->fd, &signal_info, sizeof signal_info);
-	if (!(len == -1 && errno == EAGAIN) && len != sizeof signal_info)
-		/* Is there anything we can do here?  Will this ever happen? */
-		wl_log("signalfd read error: %m\n");
-#endif
 
 	return signal_source->func(signal_source->signal_number,
 				   signal_source->base.data);
 }
+#endif
 
 struct wl_event_source_interface signal_source_interface = {
 	wl_event_source_signal_dispatch,
@@ -421,21 +1592,48 @@ wl_event_loop_add_signal(struct wl_event_loop *loop,
 	source->signal_number = signal_number;
 	source->func = func;
 
+#ifdef HAVE_SYS_SIGNALFD_H
+	/* Linux. Add the signal to the loop's shared signalfd, blocking
+	 * its delivery to the process unless that's already done. */
+	if (wl_signalfd_ensure_source(loop) < 0) {
+		free(source);
+		return NULL;
+	}
+
+	if (!sigismember(&loop->signals.mask, signal_number)) {
+		sigemptyset(&mask);
+		sigaddset(&mask, signal_number);
+		sigprocmask(SIG_BLOCK, &mask, NULL);
+	}
+
+	source->base.fd = -1;
+	source->base.loop = loop;
+	source->base.data = data;
+	source->base.priority = WL_EVENT_SOURCE_PRIORITY_DEFAULT;
+	memset(&source->base.profile, 0, sizeof source->base.profile);
+	wl_list_init(&source->base.link);
+	wl_list_insert(loop->signals.sources.prev, &source->signal_link);
+
+	if (wl_signalfd_update(loop) < 0) {
+		wl_list_remove(&source->signal_link);
+		wl_signalfd_update(loop);
+		free(source);
+		return NULL;
+	}
+
+	return &source->base;
+#else
 	/* Block delivery of signal_number to this process. */
 	sigemptyset(&mask);
 	sigaddset(&mask, signal_number);
 	sigprocmask(SIG_BLOCK, &mask, NULL);
 
-#ifdef HAVE_SYS_SIGNALFD_H
-	/* Linux. Use signalfd. */
-	source->base.fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
-
-	return add_source(loop, &source->base, WL_EVENT_READABLE, data);
-#else
 	/* FreeBSD. Use kqueue() signals directly. */
        source->base.fd = 0;
        source->base.loop = loop;
        source->base.data = data;
+       source->base.priority = WL_EVENT_SOURCE_PRIORITY_DEFAULT;
+       memset(&source->base.profile, 0, sizeof source->base.profile);
        wl_list_init(&source->base.link);
 
        EV_SET(&ev, signal_number, EVFILT_SIGNAL, EV_ADD | EV_ENABLE, 0, 0,
@@ -455,22 +1653,32 @@ wl_event_loop_add_signal(struct wl_event_loop *loop,
 struct wl_event_source_idle {
 	struct wl_event_source base;
 	wl_event_loop_idle_func_t func;
+	/* Stays around after running, and is queued on the idle list
+	 * only while armed. */
+	int persistent;
 };
 
 struct wl_event_source_interface idle_source_interface = {
 	NULL,
 };
 
-WL_EXPORT struct wl_event_source *
-wl_event_loop_add_idle(struct wl_event_loop *loop,
-		       wl_event_loop_idle_func_t func,
-		       void *data)
+static struct wl_event_source_idle *
+idle_source_create(struct wl_event_loop *loop,
+		   wl_event_loop_idle_func_t func,
+		   void *data)
 {
 	struct wl_event_source_idle *source;
 
-	source = malloc(sizeof *source);
-	if (source == NULL)
-		return NULL;
+	if (!wl_list_empty(&loop->free_idle_list)) {
+		source = container_of(loop->free_idle_list.next,
+				      struct wl_event_source_idle, base.link);
+		wl_list_remove(&source->base.link);
+		loop->free_idle_count--;
+	} else {
+		source = malloc(sizeof *source);
+		if (source == NULL)
+			return NULL;
+	}
 
 	source->base.interface = &idle_source_interface;
 	source->base.loop = loop;
@@ -478,12 +1686,145 @@ wl_event_loop_add_idle(struct wl_event_loop *loop,
 
 	source->func = func;
 	source->base.data = data;
+	source->persistent = 0;
+	source->base.priority = WL_EVENT_SOURCE_PRIORITY_DEFAULT;
+	memset(&source->base.profile, 0, sizeof source->base.profile);
+
+	return source;
+}
+
+WL_EXPORT struct wl_event_source *
+wl_event_loop_add_idle(struct wl_event_loop *loop,
+		       wl_event_loop_idle_func_t func,
+		       void *data)
+{
+	struct wl_event_source_idle *source;
+
+	source = idle_source_create(loop, func, data);
+	if (source == NULL)
+		return NULL;
 
 	wl_list_insert(loop->idle_list.prev, &source->base.link);
 
 	return &source->base;
 }
 
+/* Create an idle source that starts out disarmed and isn't removed
+ * after it runs.  Arm it with wl_event_source_idle_update() each time
+ * it should run; that never allocates. */
+WL_EXPORT struct wl_event_source *
+wl_event_loop_create_idle(struct wl_event_loop *loop,
+			  wl_event_loop_idle_func_t func,
+			  void *data)
+{
+	struct wl_event_source_idle *source;
+
+	source = idle_source_create(loop, func, data);
+	if (source == NULL)
+		return NULL;
+
+	source->persistent = 1;
+	wl_list_init(&source->base.link);
+
+	return &source->base;
+}
+
+/* Arm or disarm an idle source made by wl_event_loop_create_idle().
+ * Arming an armed source keeps its place in the queue.  An idle source
+ * armed from its own callback runs on the next dispatch. */
+WL_EXPORT int
+wl_event_source_idle_update(struct wl_event_source *source, int armed)
+{
+	struct wl_event_source_idle *idle =
+		(struct wl_event_source_idle *) source;
+	int queued = !wl_list_empty(&source->link);
+
+	/* Removed sources sit on the destroy list until the next dispatch
+	 * and have persistent cleared, so they're refused here too. */
+	if (source->interface != &idle_source_interface ||
+	    !idle->persistent) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (armed && !queued) {
+		wl_list_insert(source->loop->idle_list.prev, &source->link);
+	} else if (!armed && queued) {
+		wl_list_remove(&source->link);
+		wl_list_init(&source->link);
+	}
+
+	return 0;
+}
+
+/* Run func(data) on the loop's thread during a later dispatch.  This is
+ * the one call that is safe from any thread.  Tasks from one thread run
+ * in the order they were posted, and a batch of posts wakes the loop
+ * only once.  Tasks still queued when the loop is destroyed are dropped
+ * without running. */
+WL_EXPORT int
+wl_event_loop_post(struct wl_event_loop *loop,
+		   wl_event_loop_idle_func_t func,
+		   void *data)
+{
+	struct wl_event_loop_task *task, *head;
+	uint64_t one = 1;
+	ssize_t ret;
+
+	task = malloc(sizeof *task);
+	if (task == NULL)
+		return -1;
+
+	task->func = func;
+	task->data = data;
+
+	head = __atomic_load_n(&loop->posted, __ATOMIC_RELAXED);
+	do {
+		task->next = head;
+	} while (!__atomic_compare_exchange_n(&loop->posted, &head, task, 1,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED));
+
+	/* Whoever finds the queue empty wakes the loop; later posts
+	 * ride along with that wakeup. */
+	if (head != NULL)
+		return 0;
+
+	do {
+		ret = write(loop->post_fd[1], &one, sizeof one);
+	} while (ret < 0 && errno == EINTR);
+
+	/* A full pipe already has a wakeup pending. */
+	if (ret < 0 && errno != EAGAIN)
+		return -1;
+
+	return 0;
+}
+
+/* Ready sources are dispatched in priority order within each wakeup,
+ * highest first.  Only matters for sources that come back from the
+ * kernel, ie fd and signal sources, and timers on kqueue.  On Linux all
+ * signal sources share one signalfd, which runs at the highest priority
+ * of any of them. */
+WL_EXPORT int
+wl_event_source_set_priority(struct wl_event_source *source,
+			     enum wl_event_source_priority priority)
+{
+	if ((unsigned int) priority >= WL_EVENT_SOURCE_PRIORITY_COUNT) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	source_set_priority(source, priority);
+
+#ifdef HAVE_SYS_SIGNALFD_H
+	if (source->interface == &signal_source_interface)
+		wl_signalfd_update(source->loop);
+#endif
+
+	return 0;
+}
+
 WL_EXPORT void
 wl_event_source_check(struct wl_event_source *source)
 {
@@ -497,17 +1838,51 @@ wl_event_source_remove(struct wl_event_source *source)
 {
 	struct wl_event_loop *loop = source->loop;
 
+	if (source->priority != WL_EVENT_SOURCE_PRIORITY_DEFAULT)
+		loop->prioritized--;
+
 	/* We need to explicitly remove the fd, since closing the fd
 	 * isn't enough in case we've dup'ed the fd. */
 	if (source->fd >= 0) {
+#ifdef WL_EVENT_LOOP_IO_URING
+		if (loop->uring)
+			wl_uring_remove(loop->uring, source);
+		else
+#endif
 		epoll_ctl(loop->event_fd, EPOLL_CTL_DEL, source->fd, NULL);
 		close(source->fd);
 		source->fd = -1;
+		loop->source_count--;
+	}
+
+#ifdef HAVE_SYS_TIMERFD_H
+	if (source->interface == &timer_source_interface) {
+		struct wl_event_source_timer *timer =
+			(struct wl_event_source_timer *) source;
+
+		if (timer->heap_index >= 0)
+			wl_timer_heap_remove(&loop->timers, timer);
+		wl_list_remove(&timer->expired_link);
+		wl_list_init(&timer->expired_link);
 	}
+#endif
+
+	if (source->interface == &idle_source_interface)
+		((struct wl_event_source_idle *) source)->persistent = 0;
 
 	wl_list_remove(&source->link);
 	wl_list_insert(&loop->destroy_list, &source->link);
 
+#ifdef HAVE_SYS_SIGNALFD_H
+	if (source->interface == &signal_source_interface) {
+		struct wl_event_source_signal *signal =
+			(struct wl_event_source_signal *) source;
+
+		wl_list_remove(&signal->signal_link);
+		wl_signalfd_update(loop);
+	}
+#endif
+
 	return 0;
 }
 #elif HAVE_SYS_EVENT_H
@@ -517,6 +1892,9 @@ wl_event_source_remove(struct wl_event_source *source)
        struct wl_event_loop *loop = source->loop;
        int ret = 0, saved_errno = 0;
 
+       if (source->priority != WL_EVENT_SOURCE_PRIORITY_DEFAULT)
+               loop->prioritized--;
+
        /* Since FreeBSD doesn't treat all event sources as FDs, we need to
         * differentiate by source interface. */
        if (source->interface == &fd_source_interface && source->fd >= 0) {
@@ -548,6 +1926,7 @@ wl_event_source_remove(struct wl_event_source *source)
                }
 
                close(source->fd);
+               loop->source_count--;
        } else if (source->interface == &timer_source_interface) {
                struct kevent ev;
 
@@ -580,6 +1959,9 @@ wl_event_source_remove(struct wl_event_source *source)
        /* Tidy up the source. */
        source->fd = -1;
 
+       if (source->interface == &idle_source_interface)
+               ((struct wl_event_source_idle *) source)->persistent = 0;
+
        wl_list_remove(&source->link);
        wl_list_insert(&loop->destroy_list, &source->link);
 
@@ -592,22 +1974,130 @@ wl_event_loop_process_destroy_list(struct wl_event_loop *loop)
 {
 	struct wl_event_source *source, *next;
 
-	wl_list_for_each_safe(source, next, &loop->destroy_list, link)
-		free(source);
+	wl_list_for_each_safe(source, next, &loop->destroy_list, link) {
+		if (source->interface == &idle_source_interface &&
+		    loop->free_idle_count < WL_EVENT_LOOP_MAX_FREE_IDLE) {
+			wl_list_insert(&loop->free_idle_list, &source->link);
+			loop->free_idle_count++;
+		} else {
+			free(source);
+		}
+	}
 
 	wl_list_init(&loop->destroy_list);
 }
 
+static int
+wl_event_loop_post_dispatch(int fd, uint32_t mask, void *data)
+{
+	struct wl_event_loop *loop = data;
+	struct wl_event_loop_task *task, *next, *list = NULL;
+	char buf[64];
+
+	/* Clear the wakeup before taking the queue, so a task pushed
+	 * after the exchange finds the queue empty and wakes us again.
+	 * An eventfd is reset by a single read, a socket is drained. */
+	while (read(fd, buf, sizeof buf) == sizeof buf)
+		;
+
+	task = __atomic_exchange_n(&loop->posted, NULL, __ATOMIC_ACQUIRE);
+	if (task == NULL)
+		return 0;
+
+	/* The queue is a stack; reverse it to run tasks in order. */
+	while (task) {
+		next = task->next;
+		task->next = list;
+		list = task;
+		task = next;
+	}
+
+	loop->stats.post_wakeups++;
+	while (list) {
+		task = list;
+		list = task->next;
+		loop->stats.posted_tasks++;
+		task->func(task->data);
+		free(task);
+	}
+
+	return 1;
+}
+
+static int
+wl_event_loop_post_init(struct wl_event_loop *loop)
+{
+	loop->posted = NULL;
+
+#ifdef HAVE_SYS_EVENTFD_H
+	loop->post_fd[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (loop->post_fd[0] < 0)
+		return -1;
+	loop->post_fd[1] = loop->post_fd[0];
+#else
+	if (wl_os_socketpair_cloexec(AF_UNIX, SOCK_STREAM, 0,
+				     loop->post_fd) < 0)
+		return -1;
+	fcntl(loop->post_fd[0], F_SETFL, O_NONBLOCK);
+	fcntl(loop->post_fd[1], F_SETFL, O_NONBLOCK);
+#endif
+
+	loop->post_source = wl_event_loop_add_fd(loop, loop->post_fd[0],
+						 WL_EVENT_READABLE,
+						 wl_event_loop_post_dispatch,
+						 loop);
+	if (loop->post_source == NULL) {
+		close(loop->post_fd[0]);
+		if (loop->post_fd[1] != loop->post_fd[0])
+			close(loop->post_fd[1]);
+		return -1;
+	}
+
+	/* Internal source; don't let it count towards the batch size. */
+	loop->source_count--;
+
+	return 0;
+}
+
+static void
+wl_event_loop_post_fini(struct wl_event_loop *loop)
+{
+	struct wl_event_loop_task *task, *next;
+
+	wl_event_source_remove(loop->post_source);
+	loop->source_count++;
+	close(loop->post_fd[0]);
+	if (loop->post_fd[1] != loop->post_fd[0])
+		close(loop->post_fd[1]);
+
+	for (task = loop->posted; task; task = next) {
+		next = task->next;
+		free(task);
+	}
+}
+
 WL_EXPORT struct wl_event_loop *
 wl_event_loop_create(void)
 {
 	struct wl_event_loop *loop;
+#ifdef WL_EVENT_LOOP_IO_URING
+	const char *backend;
+#endif
 
 	loop = malloc(sizeof *loop);
 	if (loop == NULL)
 		return NULL;
 
 #ifdef HAVE_SYS_EPOLL_H
+#ifdef WL_EVENT_LOOP_IO_URING
+	loop->uring = NULL;
+	backend = getenv("WAYLAND_EVENT_LOOP");
+	if (backend && strcmp(backend, "io_uring") == 0)
+		loop->uring = wl_uring_create();
+	if (loop->uring)
+		loop->event_fd = loop->uring->fd;
+	else
+#endif
 	loop->event_fd = wl_os_epoll_create_cloexec();
 	if (loop->event_fd < 0) {
 		free(loop);
@@ -622,129 +2112,480 @@ wl_event_loop_create(void)
 #endif
 
 	wl_list_init(&loop->check_list);
+	loop->max_check_passes = 0;
+	loop->checks_pending = 0;
 	wl_list_init(&loop->idle_list);
 	wl_list_init(&loop->destroy_list);
+	wl_list_init(&loop->free_idle_list);
+	loop->free_idle_count = 0;
+
+#ifdef HAVE_SYS_TIMERFD_H
+	memset(&loop->timers, 0, sizeof loop->timers);
+#endif
+#ifdef HAVE_SYS_SIGNALFD_H
+	loop->signals.source = NULL;
+	wl_list_init(&loop->signals.sources);
+	wl_list_init(&loop->signals.routed);
+	sigemptyset(&loop->signals.mask);
+#endif
+	loop->source_count = 0;
+	loop->max_events = 0;
+	loop->batch = NULL;
+	loop->batch_size = 0;
+	memset(&loop->stats, 0, sizeof loop->stats);
+	loop->profiling = 0;
+	memset(&loop->profile, 0, sizeof loop->profile);
+	loop->prioritized = 0;
+	loop->batch_priority = NULL;
+	loop->batch_priority_size = 0;
+	loop->preempt_budget = 0;
 
 	wl_signal_init(&loop->destroy_signal);
 
+	if (wl_event_loop_post_init(loop) < 0) {
+#ifdef WL_EVENT_LOOP_IO_URING
+		if (loop->uring)
+			wl_uring_destroy(loop->uring);
+		else
+#endif
+		close(loop->event_fd);
+		free(loop);
+		return NULL;
+	}
+
 	return loop;
 }
 
 WL_EXPORT void
 wl_event_loop_destroy(struct wl_event_loop *loop)
 {
+	struct wl_event_source *source, *next;
+
 	wl_signal_emit(&loop->destroy_signal, loop);
 
+#ifdef HAVE_SYS_TIMERFD_H
+	if (loop->timers.source)
+		wl_event_source_remove(loop->timers.source);
+	free(loop->timers.data);
+#endif
+#ifdef HAVE_SYS_SIGNALFD_H
+	if (loop->signals.source)
+		wl_event_source_remove(loop->signals.source);
+#endif
+	wl_event_loop_post_fini(loop);
 	wl_event_loop_process_destroy_list(loop);
+	wl_list_for_each_safe(source, next, &loop->free_idle_list, link)
+		free(source);
+#ifdef WL_EVENT_LOOP_IO_URING
+	if (loop->uring)
+		wl_uring_destroy(loop->uring);
+	else
+#endif
 	close(loop->event_fd);
+	free(loop->batch);
+	free(loop->batch_priority);
 	free(loop);
 }
 
-#ifdef HAVE_SYS_EPOLL_H
-static int
-post_dispatch_check(struct wl_event_loop *loop)
+/* Set how many events a single dispatch fetches from the kernel, or 0
+ * to size the batch by the number of registered sources. */
+WL_EXPORT void
+wl_event_loop_set_max_events(struct wl_event_loop *loop, int max_events)
 {
-	struct epoll_event ep;
-	struct wl_event_source *source, *next;
-	int n;
+	loop->max_events = max_events > 0 ? max_events : 0;
+}
 
-	ep.events = 0;
-	n = 0;
-	wl_list_for_each_safe(source, next, &loop->check_list, link)
-		n += source->interface->dispatch(source, &ep);
+WL_EXPORT void
+wl_event_loop_get_stats(struct wl_event_loop *loop,
+			struct wl_event_loop_stats *stats)
+{
+	*stats = loop->stats;
+}
 
-	return n;
+/* Once the callbacks of one wakeup have run for longer than budget_us,
+ * leave the remaining events below input priority for the next wakeup,
+ * so input that arrived in the meantime is handled first.  Only applies
+ * while some source has a non-default priority; 0 disables it. */
+WL_EXPORT void
+wl_event_loop_set_preempt_budget(struct wl_event_loop *loop,
+				 uint32_t budget_us)
+{
+	loop->preempt_budget = (uint64_t) budget_us * 1000;
 }
-#elif HAVE_SYS_EVENT_H
-static int
-post_dispatch_check(struct wl_event_loop *loop)
+
+/* Limit how many passes over the check sources a dispatch makes, or 0
+ * for no limit. */
+WL_EXPORT void
+wl_event_loop_set_max_check_passes(struct wl_event_loop *loop,
+				   int max_passes)
 {
-       struct kevent ev;
-       struct wl_event_source *source, *next;
-       int n;
+	loop->max_check_passes = max_passes > 0 ? max_passes : 0;
+}
+
+/* Time every callback the loop runs.  Off by default; when on, it costs
+ * two clock_gettime() calls per callback, which the vDSO serves without
+ * a syscall. */
+WL_EXPORT void
+wl_event_loop_set_profiling(struct wl_event_loop *loop, int enabled)
+{
+	loop->profiling = !!enabled;
+}
 
-       ev.filter = 0;
-       n = 0;
-       wl_list_for_each_safe(source, next, &loop->check_list, link)
-               n += source->interface->dispatch(source, &ev);
+WL_EXPORT void
+wl_event_loop_get_profile(struct wl_event_loop *loop,
+			  struct wl_event_loop_profile *profile)
+{
+	*profile = loop->profile;
+}
 
-       return n;
+WL_EXPORT void
+wl_event_source_get_profile(struct wl_event_source *source,
+			    struct wl_event_source_profile *profile)
+{
+	*profile = source->profile;
+}
+
+/* Return the buffer to fetch events into and its size in *size.  Small
+ * batches use the caller's stack buffer; larger ones a buffer kept on
+ * the loop, falling back to the stack buffer if it can't grow. */
+static wl_event_loop_event_t *
+wl_event_loop_get_batch(struct wl_event_loop *loop,
+			wl_event_loop_event_t *stack, int *size)
+{
+	wl_event_loop_event_t *batch;
+	int n;
+
+	if (loop->max_events > 0)
+		n = loop->max_events;
+	else if (loop->source_count < WL_EVENT_LOOP_MIN_BATCH)
+		n = WL_EVENT_LOOP_MIN_BATCH;
+	else if (loop->source_count > WL_EVENT_LOOP_MAX_BATCH)
+		n = WL_EVENT_LOOP_MAX_BATCH;
+	else
+		n = loop->source_count;
+
+	if (n <= WL_EVENT_LOOP_MIN_BATCH) {
+		*size = n;
+		return stack;
+	}
+
+	if (n > loop->batch_size) {
+		batch = realloc(loop->batch, n * sizeof *batch);
+		if (batch == NULL) {
+			*size = WL_EVENT_LOOP_MIN_BATCH;
+			return stack;
+		}
+		loop->batch = batch;
+		loop->batch_size = n;
+	}
+
+	*size = n;
+	return loop->batch;
+}
+
+static void
+wl_event_loop_update_stats(struct wl_event_loop *loop, int count, int size)
+{
+	struct wl_event_loop_stats *stats = &loop->stats;
+
+	stats->wakeups++;
+	stats->events += count;
+	if ((uint32_t) count > stats->max_events_per_wakeup)
+		stats->max_events_per_wakeup = count;
+	if (count == size)
+		stats->full_batches++;
+	stats->batch_size = size;
 }
-#endif
 
 WL_EXPORT void
 wl_event_loop_dispatch_idle(struct wl_event_loop *loop)
 {
 	struct wl_event_source_idle *source;
+	struct wl_list pending, current;
+	uint64_t start;
+	int persistent;
+
+	/* Only run the sources queued so far.  Idle sources added from
+	 * an idle callback run on the next dispatch, so a handler that
+	 * keeps re-queuing itself can't stall the loop. */
+	wl_list_init(&pending);
+	wl_list_insert_list(&pending, &loop->idle_list);
+	wl_list_init(&loop->idle_list);
 
-	while (!wl_list_empty(&loop->idle_list)) {
-		source = container_of(loop->idle_list.next,
+	while (!wl_list_empty(&pending)) {
+		source = container_of(pending.next,
 				      struct wl_event_source_idle, base.link);
+		/* Disarm persistent sources first so the callback can re-arm
+		 * them.  Park one-shot sources on their own list so we can
+		 * tell whether the callback removed them. */
+		persistent = source->persistent;
+		wl_list_remove(&source->base.link);
+		if (persistent) {
+			wl_list_init(&source->base.link);
+		} else {
+			wl_list_init(&current);
+			wl_list_insert(&current, &source->base.link);
+		}
+
+		start = loop->profiling ? timer_now() : 0;
 		source->func(source->base.data);
-		wl_event_source_remove(&source->base);
+		if (loop->profiling)
+			loop->profile.idle_ns +=
+				wl_event_source_account(&source->base, start,
+							timer_now());
+
+		if (!persistent && !wl_list_empty(&current))
+			wl_event_source_remove(&source->base);
+	}
+}
+
+static void
+wl_event_source_dispatch(struct wl_event_source *source,
+			 wl_event_loop_event_t *ev, uint64_t wakeup)
+{
+	struct wl_event_loop *loop = source->loop;
+	uint64_t start, latency;
+
+	if (!loop->profiling) {
+		source->interface->dispatch(source, ev);
+		return;
+	}
+
+	start = timer_now();
+	source->interface->dispatch(source, ev);
+	loop->profile.dispatch_ns +=
+		wl_event_source_account(source, start, timer_now());
+
+	latency = start - wakeup;
+	loop->profile.latency_samples++;
+	loop->profile.latency_total_ns += latency;
+	if (latency > loop->profile.latency_max_ns)
+		loop->profile.latency_max_ns = latency;
+}
+
+static struct wl_event_source *
+wl_event_loop_event_source(wl_event_loop_event_t *ev)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	return ev->data.ptr;
+#elif HAVE_SYS_EVENT_H
+	return ev->udata;
+#endif
+}
+
+/* Only level-triggered fd sources are reported again by the next wait
+ * if they aren't dispatched.  Edge-triggered fds, and on kqueue the
+ * oneshot timers and signals, would be lost, so they're never skipped. */
+static int
+wl_event_source_can_defer(struct wl_event_source *source)
+{
+	struct wl_event_source_fd *fd_source =
+		(struct wl_event_source_fd *) source;
+
+	return source->interface == &fd_source_interface &&
+		!(fd_source->mask & WL_EVENT_EDGE_TRIGGERED);
+}
+
+static uint8_t *
+wl_event_loop_get_batch_priority(struct wl_event_loop *loop, int count)
+{
+	uint8_t *priority;
+
+	if (count > loop->batch_priority_size) {
+		priority = realloc(loop->batch_priority, count);
+		if (priority == NULL)
+			return NULL;
+		loop->batch_priority = priority;
+		loop->batch_priority_size = count;
+	}
+
+	return loop->batch_priority;
+}
+
+static void
+wl_event_loop_dispatch_batch(struct wl_event_loop *loop,
+			     wl_event_loop_event_t *ev, int count)
+{
+	struct wl_event_source *source;
+	uint64_t wakeup, start = 0;
+	uint8_t *priority = NULL;
+	int i, p, preempt = 0;
+
+	wakeup = loop->profiling ? timer_now() : 0;
+
+	if (loop->prioritized > 0)
+		priority = wl_event_loop_get_batch_priority(loop, count);
+
+	if (priority == NULL) {
+		for (i = 0; i < count; i++) {
+			source = wl_event_loop_event_source(&ev[i]);
+			if (source->fd != -1)
+				wl_event_source_dispatch(source, &ev[i],
+							 wakeup);
+		}
+		return;
+	}
+
+	/* Take the priorities up front so a callback changing one can't
+	 * get a source dispatched twice or skipped. */
+	for (i = 0; i < count; i++)
+		priority[i] = wl_event_loop_event_source(&ev[i])->priority;
+
+	if (loop->preempt_budget)
+		start = timer_now();
+
+	for (p = 0; p < WL_EVENT_SOURCE_PRIORITY_COUNT; p++) {
+		for (i = 0; i < count; i++) {
+			source = wl_event_loop_event_source(&ev[i]);
+			if (priority[i] != p || source->fd == -1)
+				continue;
+
+			if (preempt && p > WL_EVENT_SOURCE_PRIORITY_INPUT &&
+			    wl_event_source_can_defer(source)) {
+				loop->stats.preempted_events++;
+				continue;
+			}
+
+			wl_event_source_dispatch(source, &ev[i], wakeup);
+
+			if (loop->preempt_budget && !preempt &&
+			    timer_now() - start > loop->preempt_budget)
+				preempt = 1;
+		}
+	}
+}
+
+/* Call the check sources with an empty event until none of them
+ * reports more work.  After the first pass only the sources that did
+ * something are called again.  If the pass limit is hit, the rest is
+ * left for the next dispatch, which then doesn't block. */
+static void
+wl_event_loop_run_checks(struct wl_event_loop *loop)
+{
+	wl_event_loop_event_t ev;
+	struct wl_event_source *source;
+	struct wl_list pending, again, current;
+	uint64_t start;
+	uint32_t passes = 0;
+
+	loop->checks_pending = 0;
+	if (wl_list_empty(&loop->check_list))
+		return;
+
+	start = loop->profiling ? timer_now() : 0;
+	memset(&ev, 0, sizeof ev);
+
+	wl_list_init(&pending);
+	wl_list_insert_list(&pending, &loop->check_list);
+	wl_list_init(&loop->check_list);
+
+	while (!wl_list_empty(&pending)) {
+		if (loop->max_check_passes > 0 &&
+		    passes == (uint32_t) loop->max_check_passes) {
+			loop->stats.capped_checks++;
+			loop->checks_pending = 1;
+			break;
+		}
+		passes++;
+
+		wl_list_init(&again);
+		while (!wl_list_empty(&pending)) {
+			source = container_of(pending.next,
+					      struct wl_event_source, link);
+
+			/* Park the source on its own list so we can tell
+			 * whether the callback removed it. */
+			wl_list_remove(&source->link);
+			wl_list_init(&current);
+			wl_list_insert(&current, &source->link);
+
+			if (source->interface->dispatch(source, &ev) > 0 &&
+			    !wl_list_empty(&current)) {
+				wl_list_remove(&source->link);
+				wl_list_insert(again.prev, &source->link);
+			} else if (!wl_list_empty(&current)) {
+				wl_list_remove(&source->link);
+				wl_list_insert(loop->check_list.prev,
+					       &source->link);
+			}
+		}
+
+		wl_list_insert_list(&pending, &again);
 	}
+
+	wl_list_insert_list(loop->check_list.prev, &pending);
+
+	loop->stats.check_passes += passes;
+	if (passes > loop->stats.max_check_passes)
+		loop->stats.max_check_passes = passes;
+
+	if (loop->profiling)
+		loop->profile.check_ns += timer_now() - start;
 }
 
 #ifdef HAVE_SYS_EPOLL_H
 WL_EXPORT int
 wl_event_loop_dispatch(struct wl_event_loop *loop, int timeout)
 {
-	struct epoll_event ep[32];
-	struct wl_event_source *source;
-	int i, count, n;
+	struct epoll_event stack[WL_EVENT_LOOP_MIN_BATCH], *ep;
+	int count, size;
 
 	wl_event_loop_dispatch_idle(loop);
-
-	count = epoll_wait(loop->event_fd, ep, ARRAY_LENGTH(ep), timeout);
+	if (!wl_list_empty(&loop->idle_list) || loop->checks_pending)
+		timeout = 0;
+
+	ep = wl_event_loop_get_batch(loop, stack, &size);
+#ifdef WL_EVENT_LOOP_IO_URING
+	if (loop->uring)
+		count = wl_uring_wait(loop->uring, ep, size, timeout);
+	else
+#endif
+	count = epoll_wait(loop->event_fd, ep, size, timeout);
 	if (count < 0)
 		return -1;
 
-	for (i = 0; i < count; i++) {
-		source = ep[i].data.ptr;
-		if (source->fd != -1)
-			source->interface->dispatch(source, &ep[i]);
-	}
+	wl_event_loop_update_stats(loop, count, size);
+	wl_event_loop_dispatch_batch(loop, ep, count);
+
+#ifdef WL_EVENT_LOOP_IO_URING
+	if (loop->uring)
+		wl_uring_rearm(loop->uring, ep, count);
+#endif
 
 	wl_event_loop_process_destroy_list(loop);
 
-	do {
-		n = post_dispatch_check(loop);
-	} while (n > 0);
-		
+	wl_event_loop_run_checks(loop);
+
 	return 0;
 }
 #elif HAVE_SYS_EVENT_H
 WL_EXPORT int
 wl_event_loop_dispatch(struct wl_event_loop *loop, int timeout)
 {
-       struct kevent ev[32];
-       struct wl_event_source *source;
-       int i, count, n;
+       struct kevent stack[WL_EVENT_LOOP_MIN_BATCH], *ev;
+       int count, size;
        struct timespec timeout_spec;
 
        wl_event_loop_dispatch_idle(loop);
+       if (!wl_list_empty(&loop->idle_list) || loop->checks_pending)
+               timeout = 0;
 
        /* timeout is provided in milliseconds; convert it to a timespec. */
        timeout_spec.tv_sec = timeout / 1000;
        timeout_spec.tv_nsec = (timeout % 1000) * 1000000;
 
-       count = kevent(loop->event_fd, NULL, 0, ev, ARRAY_LENGTH(ev),
+       ev = wl_event_loop_get_batch(loop, stack, &size);
+       count = kevent(loop->event_fd, NULL, 0, ev, size,
                       (timeout != -1) ? &timeout_spec : NULL);
        if (count < 0)
                return -1;
 
-       for (i = 0; i < count; i++) {
-               source = ev[i].udata;
-               if (source->fd != -1) {
-                       source->interface->dispatch(source, &ev[i]);
-               }
-       }
+       wl_event_loop_update_stats(loop, count, size);
+       wl_event_loop_dispatch_batch(loop, ev, count);
 
        wl_event_loop_process_destroy_list(loop);
 
-       do {
-               n = post_dispatch_check(loop);
-       } while (n > 0);
+       wl_event_loop_run_checks(loop);
 
        return 0;
 }
@@ -754,9 +2595,34 @@ wl_event_loop_dispatch(struct wl_event_loop *loop, int timeout)
 WL_EXPORT int
 wl_event_loop_get_fd(struct wl_event_loop *loop)
 {
+#ifdef WL_EVENT_LOOP_IO_URING
+	/* Whoever polls the ring fd won't see completions for requests we
+	 * haven't submitted, so stop batching submissions from here on. */
+	if (loop->uring) {
+		loop->uring->eager = 1;
+		wl_uring_enter(loop->uring, 0, 0);
+	}
+#endif
+
 	return loop->event_fd;
 }
 
+/* Name of the mechanism the loop waits with: "epoll", "io_uring" or
+ * "kqueue". */
+WL_EXPORT const char *
+wl_event_loop_get_backend(struct wl_event_loop *loop)
+{
+#ifdef HAVE_SYS_EPOLL_H
+#ifdef WL_EVENT_LOOP_IO_URING
+	if (loop->uring)
+		return "io_uring";
+#endif
+	return "epoll";
+#elif HAVE_SYS_EVENT_H
+	return "kqueue";
+#endif
+}
+
 WL_EXPORT void
 wl_event_loop_add_destroy_listener(struct wl_event_loop *loop,
 				   struct wl_listener *listener)
@@ -38,11 +38,17 @@ enum side {
 static int
 usage(int ret)
 {
-	fprintf(stderr, "usage: ./scanner [client-header|server-header|code]\n");
+	fprintf(stderr, "usage: ./scanner [--dispatchers] "
+			"[client-header|server-header|code]\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Converts XML protocol descriptions supplied on "
 			"stdin to client headers,\n"
-			"server headers, or protocol marshalling code.\n");
+			"server headers, or protocol marshalling code.\n"
+			"\n"
+			"--dispatchers also emits typed dispatchers in the "
+			"headers, which call\n"
+			"listeners and interfaces directly instead of "
+			"through libffi.\n");
 	exit(ret);
 }
 
@@ -66,6 +72,7 @@ struct protocol {
 	int null_run_length;
 	char *copyright;
 	struct description *description;
+	int dispatchers;
 };
 
 struct interface {
@@ -850,6 +857,135 @@ emit_enumerations(struct interface *interface)
 	}
 }
 
+static void
+emit_dispatcher(struct wl_list *message_list, struct interface *interface,
+		enum side side)
+{
+	struct message *m;
+	struct arg *a;
+	int opcode, i;
+
+	const char *suffix = (side == SERVER) ? "interface" : "listener";
+	int n;
+
+	if (wl_list_empty(message_list))
+		return;
+
+	n = strlen(interface->name) + strlen(suffix) + 13;
+	printf("static inline int\n"
+	       "%s_%s_dispatcher(const void *implementation, void *target,\n"
+	       "%suint32_t opcode, const struct wl_message *message,\n"
+	       "%sunion wl_argument *args)\n"
+	       "{\n",
+	       interface->name, suffix, indent(n), indent(n));
+
+	/* Cast explicitly so the headers stay usable from C++. */
+	if (side == SERVER)
+		printf("\tconst struct %s_interface *impl =\n"
+		       "\t\t(const struct %s_interface *) implementation;\n"
+		       "\tstruct wl_resource *resource =\n"
+		       "\t\t(struct wl_resource *) target;\n\n",
+		       interface->name, interface->name);
+	else
+		printf("\tconst struct %s_listener *listener =\n"
+		       "\t\t(const struct %s_listener *) implementation;\n"
+		       "\tstruct wl_proxy *proxy = (struct wl_proxy *) target;\n\n",
+		       interface->name, interface->name);
+
+	printf("\tswitch (opcode) {\n");
+
+	opcode = 0;
+	wl_list_for_each(m, message_list, link) {
+		printf("\tcase %d:\n", opcode++);
+
+		if (side == SERVER) {
+			printf("\t\timpl->%s(wl_resource_get_client(resource),\n"
+			       "\t\t\tresource", m->name);
+		} else {
+			printf("\t\tlistener->%s(wl_proxy_get_user_data(proxy),\n"
+			       "\t\t\t(struct %s *) proxy",
+			       m->name, interface->name);
+		}
+
+		/* Mirror the argument layout of the listener structs
+		 * emitted above, indexing the demarshalled arguments in
+		 * wire order. */
+		i = 0;
+		wl_list_for_each(a, &m->arg_list, link) {
+			printf(",\n\t\t\t");
+
+			switch (a->type) {
+			case NEW_ID:
+				if (side == SERVER) {
+					if (a->interface_name == NULL) {
+						printf("args[%d].s, args[%d].u,\n"
+						       "\t\t\t", i, i + 1);
+						i += 2;
+					}
+					printf("args[%d].n", i);
+				} else {
+					printf("(struct %s *) args[%d].o",
+					       a->interface_name, i);
+				}
+				break;
+			case OBJECT:
+				if (side == SERVER)
+					printf("(struct wl_resource *) ");
+				else if (a->interface_name == NULL)
+					printf("(void *) ");
+				else
+					printf("(struct %s *) ",
+					       a->interface_name);
+				printf("args[%d].o", i);
+				break;
+			case INT:
+				printf("args[%d].i", i);
+				break;
+			case UNSIGNED:
+				printf("args[%d].u", i);
+				break;
+			case FIXED:
+				printf("args[%d].f", i);
+				break;
+			case STRING:
+				printf("args[%d].s", i);
+				break;
+			case ARRAY:
+				printf("args[%d].a", i);
+				break;
+			case FD:
+				printf("args[%d].h", i);
+				break;
+			}
+
+			i++;
+		}
+
+		printf(");\n"
+		       "\t\treturn 0;\n");
+	}
+
+	printf("\t}\n\n"
+	       "\treturn -1;\n"
+	       "}\n\n");
+
+	if (side == CLIENT) {
+	    printf("static inline int\n"
+		   "%s_add_typed_listener(struct %s *%s,\n"
+		   "%sconst struct %s_listener *listener, void *data)\n"
+		   "{\n"
+		   "\treturn wl_proxy_add_dispatcher((struct wl_proxy *) %s,\n"
+		   "%s%s_listener_dispatcher, listener, data);\n"
+		   "}\n\n",
+		   interface->name, interface->name, interface->name,
+		   indent(20 + strlen(interface->name)),
+		   interface->name,
+		   interface->name,
+		   indent(39),
+		   interface->name);
+	}
+}
+
 static void
 emit_structs(struct wl_list *message_list, struct interface *interface, enum side side)
 {
@@ -1019,11 +1155,15 @@ emit_header(struct protocol *protocol, enum side side)
 
 		if (side == SERVER) {
 			emit_structs(&i->request_list, i, side);
+			if (protocol->dispatchers)
+				emit_dispatcher(&i->request_list, i, side);
 			emit_opcodes(&i->event_list, i);
 			emit_opcode_versions(&i->event_list, i);
 			emit_event_wrappers(&i->event_list, i);
 		} else {
 			emit_structs(&i->event_list, i, side);
+			if (protocol->dispatchers)
+				emit_dispatcher(&i->event_list, i, side);
 			emit_opcodes(&i->request_list, i);
 			emit_stubs(&i->request_list, i);
 		}
@@ -1257,6 +1397,13 @@ int main(int argc, char *argv[])
 		SERVER_HEADER,
 		CODE,
 	} mode;
+	int dispatchers = 0;
+
+	if (argc == 3 && strcmp(argv[1], "--dispatchers") == 0) {
+		dispatchers = 1;
+		argc--;
+		argv++;
+	}
 
 	if (argc != 2)
 		usage(EXIT_FAILURE);
@@ -1275,6 +1422,7 @@ int main(int argc, char *argv[])
 	protocol.type_index = 0;
 	protocol.null_run_length = 0;
 	protocol.copyright = NULL;
+	protocol.dispatchers = dispatchers;
 	memset(&ctx, 0, sizeof ctx);
 	ctx.protocol = &protocol;
 
@@ -103,6 +103,8 @@ struct wl_display {
 	int reader_count;
 	uint32_t read_serial;
 	pthread_cond_t reader_cond;
+
+	int lazy_events;
 };
 
 /** \endcond */
@@ -464,17 +466,14 @@ create_outgoing_proxy(struct wl_proxy *proxy, const struct wl_message *message,
 		      union wl_argument *args,
 		      const struct wl_interface *interface)
 {
-	int i, count;
-	const char *signature;
-	struct argument_details arg;
+	int i;
+	const struct wl_message_desc *desc;
+	struct wl_message_desc desc_storage;
 	struct wl_proxy *new_proxy = NULL;
 
-	signature = message->signature;
-	count = arg_count_for_signature(signature);
-	for (i = 0; i < count; i++) {
-		signature = get_next_argument(signature, &arg);
-
-		switch (arg.type) {
+	desc = wl_message_get_desc(message, &desc_storage);
+	for (i = 0; i < desc->count; i++) {
+		switch (desc->types[i]) {
 		case 'n':
 			new_proxy = proxy_create(proxy, interface);
 			if (new_proxy == NULL)
@@ -515,7 +514,7 @@ wl_proxy_marshal_array_constructor(struct wl_proxy *proxy,
 				   uint32_t opcode, union wl_argument *args,
 				   const struct wl_interface *interface)
 {
-	struct wl_closure *closure;
+	struct wl_closure closure;
 	struct wl_proxy *new_proxy = NULL;
 	const struct wl_message *message;
 
@@ -529,22 +528,20 @@ wl_proxy_marshal_array_constructor(struct wl_proxy *proxy,
 			goto err_unlock;
 	}
 
-	closure = wl_closure_marshal(&proxy->object, opcode, args, message);
-	if (closure == NULL) {
+	if (wl_closure_init_marshal(&closure, &proxy->object,
+				    opcode, args, message) < 0) {
 		wl_log("Error marshalling request: %m\n");
 		abort();
 	}
 
 	if (debug_client)
-		wl_closure_print(closure, &proxy->object, true);
+		wl_closure_print(&closure, &proxy->object, true);
 
-	if (wl_closure_send(closure, proxy->display->connection)) {
+	if (wl_closure_send(&closure, proxy->display->connection)) {
 		wl_log("Error sending request: %m\n");
 		abort();
 	}
 
-	wl_closure_destroy(closure);
-
  err_unlock:
 	pthread_mutex_unlock(&proxy->display->mutex);
 
@@ -844,9 +841,10 @@ wl_display_connect(const char *name)
 WL_EXPORT void
 wl_display_disconnect(struct wl_display *display)
 {
+	wl_event_queue_release(&display->default_queue);
+	wl_event_queue_release(&display->display_queue);
 	wl_connection_destroy(display->connection);
 	wl_map_release(&display->objects);
-	wl_event_queue_release(&display->default_queue);
 	pthread_mutex_destroy(&display->mutex);
 	pthread_cond_destroy(&display->reader_cond);
 	close(display->fd);
@@ -935,17 +933,12 @@ static int
 create_proxies(struct wl_proxy *sender, struct wl_closure *closure)
 {
 	struct wl_proxy *proxy;
-	const char *signature;
-	struct argument_details arg;
+	const struct wl_message_desc *desc = closure->desc;
 	uint32_t id;
 	int i;
-	int count;
 
-	signature = closure->message->signature;
-	count = arg_count_for_signature(signature);
-	for (i = 0; i < count; i++) {
-		signature = get_next_argument(signature, &arg);
-		switch (arg.type) {
+	for (i = 0; i < desc->count; i++) {
+		switch (desc->types[i]) {
 		case 'n':
 			id = closure->args[i].n;
 			if (id == 0) {
@@ -969,16 +962,12 @@ create_proxies(struct wl_proxy *sender, struct wl_closure *closure)
 static void
 increase_closure_args_refcount(struct wl_closure *closure)
 {
-	const char *signature;
-	struct argument_details arg;
-	int i, count;
+	const struct wl_message_desc *desc = closure->desc;
+	int i;
 	struct wl_proxy *proxy;
 
-	signature = closure->message->signature;
-	count = arg_count_for_signature(signature);
-	for (i = 0; i < count; i++) {
-		signature = get_next_argument(signature, &arg);
-		switch (arg.type) {
+	for (i = 0; i < desc->count; i++) {
+		switch (desc->types[i]) {
 		case 'n':
 		case 'o':
 			proxy = (struct wl_proxy *) closure->args[i].o;
@@ -999,6 +988,8 @@ queue_event(struct wl_display *display, int len)
 	struct wl_proxy *proxy;
 	struct wl_closure *closure;
 	const struct wl_message *message;
+	const struct wl_message_desc *desc;
+	struct wl_message_desc desc_storage;
 	struct wl_event_queue *queue;
 
 	wl_connection_copy(display->connection, p, sizeof p);
@@ -1018,22 +1009,37 @@ queue_event(struct wl_display *display, int len)
 	}
 
 	message = &proxy->object.interface->events[opcode];
-	closure = wl_connection_demarshal(display->connection, size,
-					  &display->objects, message);
-	if (!closure)
-		return -1;
 
-	if (create_proxies(proxy, closure) < 0) {
-		wl_closure_destroy(closure);
-		return -1;
-	}
+	/* Events that don't refer to objects or fds mean the same whenever
+	 * they're parsed, so in lazy mode that's left to the thread that
+	 * dispatches them. */
+	desc = NULL;
+	if (display->lazy_events)
+		desc = wl_message_get_desc(message, &desc_storage);
+	if (desc && desc->self_contained) {
+		closure = wl_connection_demarshal_raw(display->connection,
+						      size, message, desc);
+		if (!closure)
+			return -1;
+	} else {
+		closure = wl_connection_demarshal(display->connection, size,
+						  &display->objects, message);
+		if (!closure)
+			return -1;
 
-	if (wl_closure_lookup_objects(closure, &display->objects) != 0) {
-		wl_closure_destroy(closure);
-		return -1;
+		if (create_proxies(proxy, closure) < 0) {
+			wl_closure_destroy(closure);
+			return -1;
+		}
+
+		if (wl_closure_lookup_objects(closure, &display->objects) != 0) {
+			wl_closure_destroy(closure);
+			return -1;
+		}
+
+		increase_closure_args_refcount(closure);
 	}
 
-	increase_closure_args_refcount(closure);
 	proxy->refcount++;
 	closure->proxy = proxy;
 
@@ -1050,16 +1056,12 @@ queue_event(struct wl_display *display, int len)
 static void
 decrease_closure_args_refcount(struct wl_closure *closure)
 {
-	const char *signature;
-	struct argument_details arg;
-	int i, count;
+	const struct wl_message_desc *desc = closure->desc;
+	int i;
 	struct wl_proxy *proxy;
 
-	signature = closure->message->signature;
-	count = arg_count_for_signature(signature);
-	for (i = 0; i < count; i++) {
-		signature = get_next_argument(signature, &arg);
-		switch (arg.type) {
+	for (i = 0; i < desc->count; i++) {
+		switch (desc->types[i]) {
 		case 'n':
 		case 'o':
 			proxy = (struct wl_proxy *) closure->args[i].o;
@@ -1109,6 +1111,13 @@ dispatch_event(struct wl_display *display, struct wl_event_queue *queue)
 
 	pthread_mutex_unlock(&display->mutex);
 
+	if (wl_closure_decode(closure) < 0) {
+		pthread_mutex_lock(&display->mutex);
+		display_fatal_error(display, errno);
+		wl_closure_destroy(closure);
+		return;
+	}
+
 	if (proxy->dispatcher) {
 		if (debug_client)
 			wl_closure_print(closure, &proxy->object, false);
@@ -1123,44 +1132,57 @@ dispatch_event(struct wl_display *display, struct wl_event_queue *queue)
 				  &proxy->object, opcode, proxy->user_data);
 	}
 
-	wl_closure_destroy(closure);
-
 	pthread_mutex_lock(&display->mutex);
+
+	/* Closures are recycled through the connection's closure pool,
+	 * which is protected by the display mutex. */
+	wl_closure_destroy(closure);
 }
 
 static int
 read_events(struct wl_display *display)
 {
-	int total, rem, size;
+	int total, rem, size, reads;
 	uint32_t serial;
 
 	display->reader_count--;
 	if (display->reader_count == 0) {
-		total = wl_connection_read(display->connection);
-		if (total == -1) {
-			if (errno == EAGAIN)
-				return 0;
-
-			display_fatal_error(display, errno);
-			return -1;
-		} else if (total == 0) {
-			/* The compositor has closed the socket. This
-			 * should be considered an error so we'll fake
-			 * an errno */
-			errno = EPIPE;
-			display_fatal_error(display, errno);
-			return -1;
-		}
+		/* Queue what each read brings in, then keep reading while
+		 * the read budget allows, so a burst of events needs only
+		 * one wakeup. */
+		wl_connection_begin_read(display->connection);
+		reads = 0;
+		do {
+			total = wl_connection_read(display->connection);
+			if (total == -1) {
+				if (errno == EAGAIN) {
+					if (reads == 0)
+						return 0;
+					break;
+				}
 
-		for (rem = total; rem >= 8; rem -= size) {
-			size = queue_event(display, rem);
-			if (size == -1) {
 				display_fatal_error(display, errno);
 				return -1;
-			} else if (size == 0) {
-				break;
+			} else if (total == 0) {
+				/* The compositor has closed the socket. This
+				 * should be considered an error so we'll fake
+				 * an errno */
+				errno = EPIPE;
+				display_fatal_error(display, errno);
+				return -1;
 			}
-		}
+			reads++;
+
+			for (rem = total; rem >= 8; rem -= size) {
+				size = queue_event(display, rem);
+				if (size == -1) {
+					display_fatal_error(display, errno);
+					return -1;
+				} else if (size == 0) {
+					break;
+				}
+			}
+		} while (wl_connection_read_more(display->connection));
 
 		display->read_serial++;
 		pthread_cond_broadcast(&display->reader_cond);
@@ -1643,6 +1665,106 @@ wl_display_flush(struct wl_display *display)
 	return ret;
 }
 
+/** Retrieve closure allocator statistics for a display
+ *
+ * \param display The display context object
+ * \param stats Filled in with the current statistics
+ *
+ * Incoming events are demarshalled into closures that are recycled
+ * through a small free list on the display connection.  This returns
+ * the hit, miss and high-water counters of that free list.
+ *
+ * \memberof wl_display
+ */
+WL_EXPORT void
+wl_display_get_closure_pool_stats(struct wl_display *display,
+				  struct wl_closure_pool_stats *stats)
+{
+	pthread_mutex_lock(&display->mutex);
+	wl_connection_get_closure_pool_stats(display->connection, stats);
+	pthread_mutex_unlock(&display->mutex);
+}
+
+/** Limit the number of bytes read per call to wl_display_read_events()
+ *
+ * \param display The display context object
+ * \param budget The number of bytes, or 0 to read only once
+ *
+ * Events are queued after every read from the display socket, and the
+ * socket is read again as long as the previous read filled the
+ * connection buffer and fewer than \c budget bytes have been read.
+ * The default is 64 KiB.
+ *
+ * \sa wl_display_get_read_stats()
+ *
+ * \memberof wl_display
+ */
+WL_EXPORT void
+wl_display_set_read_budget(struct wl_display *display, uint32_t budget)
+{
+	pthread_mutex_lock(&display->mutex);
+	wl_connection_set_read_budget(display->connection, budget);
+	pthread_mutex_unlock(&display->mutex);
+}
+
+/** Retrieve socket read statistics for a display
+ *
+ * \param display The display context object
+ * \param stats Filled in with the current statistics
+ *
+ * \memberof wl_display
+ */
+WL_EXPORT void
+wl_display_get_read_stats(struct wl_display *display,
+			  struct wl_connection_read_stats *stats)
+{
+	pthread_mutex_lock(&display->mutex);
+	wl_connection_get_read_stats(display->connection, stats);
+	pthread_mutex_unlock(&display->mutex);
+}
+
+/** Retrieve file descriptor passing statistics for a display
+ *
+ * \param display The display context object
+ * \param stats Filled in with the current statistics
+ *
+ * \memberof wl_display
+ */
+WL_EXPORT void
+wl_display_get_fd_stats(struct wl_display *display,
+			struct wl_connection_fd_stats *stats)
+{
+	pthread_mutex_lock(&display->mutex);
+	wl_connection_get_fd_stats(display->connection, stats);
+	pthread_mutex_unlock(&display->mutex);
+}
+
+/** Put off parsing events until they are dispatched
+ *
+ * \param display The display context object
+ * \param enabled Nonzero to queue events in wire format
+ *
+ * Normally the thread reading from the display socket parses every
+ * event it reads while holding the display lock, including events
+ * for queues other threads dispatch and events whose proxy will be
+ * destroyed before they are dispatched.  With lazy events, events
+ * whose arguments don't refer to objects or file descriptors are
+ * queued as received and parsed by the thread dispatching them,
+ * outside the display lock.  Events for destroyed proxies are then
+ * dropped without being parsed.  Events with object, new_id or fd
+ * arguments are still parsed as they are read, since their meaning
+ * depends on the state of the connection at that point.
+ *
+ * \memberof wl_display
+ */
+WL_EXPORT void
+wl_display_set_lazy_events(struct wl_display *display, int enabled)
+{
+	pthread_mutex_lock(&display->mutex);
+	display->lazy_events = !!enabled;
+	pthread_mutex_unlock(&display->mutex);
+}
+
 /** Set the user data associated with a proxy
  *
  * \param proxy The proxy object
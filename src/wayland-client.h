@@ -166,6 +166,14 @@ uint32_t wl_display_get_protocol_error(struct wl_display *display,
 				       uint32_t *id);
 
 int wl_display_flush(struct wl_display *display);
+void wl_display_get_closure_pool_stats(struct wl_display *display,
+				       struct wl_closure_pool_stats *stats);
+void wl_display_set_read_budget(struct wl_display *display, uint32_t budget);
+void wl_display_get_read_stats(struct wl_display *display,
+			       struct wl_connection_read_stats *stats);
+void wl_display_get_fd_stats(struct wl_display *display,
+			     struct wl_connection_fd_stats *stats);
+void wl_display_set_lazy_events(struct wl_display *display, int enabled);
 int wl_display_roundtrip_queue(struct wl_display *display,
                                struct wl_event_queue *queue);
 int wl_display_roundtrip(struct wl_display *display);
@@ -80,31 +80,102 @@ void wl_map_for_each(struct wl_map *map, wl_iterator_func_t func, void *data);
 
 struct wl_connection;
 struct wl_closure;
+struct wl_closure_pool;
 struct wl_proxy;
 
 int wl_interface_equal(const struct wl_interface *iface1,
 		       const struct wl_interface *iface2);
 
+/* Bytes a readable connection may read before it yields back to the
+ * event loop. */
+#define WL_CONNECTION_DEFAULT_READ_BUDGET 65536
+
 struct wl_connection *wl_connection_create(int fd);
 void wl_connection_destroy(struct wl_connection *connection);
 void wl_connection_copy(struct wl_connection *connection, void *data, size_t size);
 void wl_connection_consume(struct wl_connection *connection, size_t size);
+void wl_connection_set_max_buffer_size(struct wl_connection *connection,
+				       size_t max_buffer_size);
+void wl_connection_get_closure_pool_stats(struct wl_connection *connection,
+					  struct wl_closure_pool_stats *stats);
 
 int wl_connection_flush(struct wl_connection *connection);
+uint32_t wl_connection_pending_input(struct wl_connection *connection);
+uint32_t wl_connection_pending_output(struct wl_connection *connection);
+uint32_t wl_connection_get_overflow_flushes(struct wl_connection *connection);
 int wl_connection_read(struct wl_connection *connection);
+void wl_connection_begin_read(struct wl_connection *connection);
+int wl_connection_read_more(struct wl_connection *connection);
+void wl_connection_set_read_budget(struct wl_connection *connection,
+				   uint32_t budget);
+void wl_connection_get_read_stats(struct wl_connection *connection,
+				  struct wl_connection_read_stats *stats);
+void wl_connection_get_fd_stats(struct wl_connection *connection,
+				struct wl_connection_fd_stats *stats);
 
 int wl_connection_write(struct wl_connection *connection, const void *data, size_t count);
 int wl_connection_queue(struct wl_connection *connection,
 			const void *data, size_t count);
 
+/* Precompiled form of a wl_message signature, so the marshalling paths
+ * don't have to re-parse the signature string for every message. */
+struct wl_message_desc {
+	const char *signature;
+	int count;
+	int since;
+	uint32_t nullable;
+	int fd_count;
+	int array_count;
+	/* Number of leading arguments before the first string or array,
+	 * and the size in bytes they take on the wire including the
+	 * message header. */
+	int fixed_count;
+	int fixed_size;
+	/* Set when all arguments are u, i, f or o, so the message is a
+	 * plain array of words; objects has a bit set for each o. */
+	int scalar;
+	uint32_t objects;
+	/* Set when no argument is an object, new_id or fd, so parsing the
+	 * message doesn't depend on connection state and can be put off
+	 * until later. */
+	int self_contained;
+	char types[WL_CLOSURE_MAX_ARGS];
+	/* Set for descriptors that live in the global cache. */
+	int cached;
+};
+
+static inline int
+wl_message_desc_nullable(const struct wl_message_desc *desc, int i)
+{
+	return desc->nullable & (1 << i);
+}
+
+const struct wl_message_desc *
+wl_message_get_desc(const struct wl_message *message,
+		    struct wl_message_desc *storage);
+
+#ifdef WL_MARSHAL_BENCHMARK
+/* Only in the marshalling benchmark's own build of connection.c.
+ * Nonzero by default; clearing it sends scalar-only messages through
+ * the generic marshalling code. */
+extern int wl_closure_scalar_fast_path;
+#endif
+
 struct wl_closure {
 	int count;
 	const struct wl_message *message;
+	const struct wl_message_desc *desc;
 	uint32_t opcode;
 	uint32_t sender_id;
 	union wl_argument args[WL_CLOSURE_MAX_ARGS];
 	struct wl_list link;
 	struct wl_proxy *proxy;
+	struct wl_closure_pool *pool;
+	int pool_class;
+	/* Size of the wire message in extra not yet parsed into args, or
+	 * 0 once it has been. */
+	uint32_t raw_size;
+	struct wl_message_desc desc_storage;
 	struct wl_array extra[0];
 };
 
@@ -126,6 +197,10 @@ void
 wl_argument_from_va_list(const char *signature, union wl_argument *args,
 			 int count, va_list ap);
 
+int
+wl_closure_init_marshal(struct wl_closure *closure, struct wl_object *sender,
+			uint32_t opcode, union wl_argument *args,
+			const struct wl_message *message);
 struct wl_closure *
 wl_closure_marshal(struct wl_object *sender,
 		    uint32_t opcode, union wl_argument *args,
@@ -140,6 +215,19 @@ wl_connection_demarshal(struct wl_connection *connection,
 			uint32_t size,
 			struct wl_map *objects,
 			const struct wl_message *message);
+struct wl_closure *
+wl_connection_demarshal_in_place(struct wl_connection *connection,
+				 uint32_t size,
+				 struct wl_map *objects,
+				 const struct wl_message *message,
+				 const struct wl_message_desc *desc);
+struct wl_closure *
+wl_connection_demarshal_raw(struct wl_connection *connection,
+			    uint32_t size,
+			    const struct wl_message *message,
+			    const struct wl_message_desc *desc);
+int
+wl_closure_decode(struct wl_closure *closure);
 
 int
 wl_closure_lookup_objects(struct wl_closure *closure, struct wl_map *objects);
@@ -41,6 +41,7 @@
 #include <fcntl.h>
 #include <sys/file.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <ffi.h>
 
 #ifdef HAVE_SYS_UCRED_H
@@ -73,6 +74,12 @@ struct wl_socket {
 	char *display_name;
 };
 
+struct wl_client_flush_rule {
+	const struct wl_interface *interface;
+	enum wl_client_flush_policy policy;
+	uint32_t param;
+};
+
 struct wl_client {
 	struct wl_connection *connection;
 	struct wl_event_source *source;
@@ -81,6 +88,7 @@ struct wl_client {
 	uint32_t id_count;
 	uint32_t mask;
 	struct wl_list link;
+	struct wl_list flush_link;
 	struct wl_map objects;
 	struct wl_signal destroy_signal;
 #ifdef HAVE_SYS_UCRED_H
@@ -91,6 +99,19 @@ struct wl_client {
 	struct ucred ucred;
 #endif
 	int error;
+
+	struct wl_client_flush_rule flush_rule;
+	struct wl_array flush_rules;
+	struct wl_event_source *flush_timer;
+	int flush_timer_armed;
+	uint64_t flush_deadline;
+	struct wl_client_flush_stats flush_stats;
+
+	uint32_t request_budget;
+	struct wl_event_source *deferred_source;
+	struct wl_client_request_stats request_stats;
+
+	int edge_triggered;
 };
 
 struct wl_display {
@@ -104,10 +125,16 @@ struct wl_display {
 	struct wl_list global_list;
 	struct wl_list socket_list;
 	struct wl_list client_list;
+	struct wl_list flush_list;
 
 	struct wl_signal destroy_signal;
 
 	struct wl_array additional_shm_formats;
+
+	size_t max_buffer_size;
+	uint32_t request_budget;
+	uint32_t read_budget;
+	int edge_triggered;
 };
 
 struct wl_global {
@@ -133,28 +160,117 @@ struct wl_resource {
 
 static int debug_server = 0;
 
+/* Clients that had events posted since the last
+ * wl_display_flush_clients() are kept on the display's flush list, so
+ * idle clients cost nothing when flushing. */
+static void
+client_mark_dirty(struct wl_client *client)
+{
+	if (wl_list_empty(&client->flush_link))
+		wl_list_insert(client->display->flush_list.prev,
+			       &client->flush_link);
+}
+
+static int
+client_flush_counted(struct wl_client *client, uint32_t *counter)
+{
+	int ret;
+
+	ret = wl_connection_flush(client->connection);
+	if (ret > 0)
+		(*counter)++;
+	else if (ret < 0 && errno == EAGAIN)
+		wl_event_source_fd_update(client->source,
+					  WL_EVENT_WRITABLE |
+					  WL_EVENT_READABLE);
+
+	return ret;
+}
+
+static uint64_t
+flush_clock_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+client_arm_flush_deadline(struct wl_client *client, uint32_t ms)
+{
+	uint64_t deadline = flush_clock_ms() + ms;
+
+	if (client->flush_timer_armed && client->flush_deadline <= deadline)
+		return;
+
+	/* A zero delay would disarm the timer. */
+	wl_event_source_timer_update(client->flush_timer, ms ? ms : 1);
+	client->flush_timer_armed = 1;
+	client->flush_deadline = deadline;
+}
+
+static void
+client_event_posted(struct wl_client *client,
+		    const struct wl_interface *interface)
+{
+	const struct wl_client_flush_rule *rule = &client->flush_rule, *r;
+	int ret;
+
+	wl_array_for_each(r, &client->flush_rules) {
+		if (r->interface == interface) {
+			rule = r;
+			break;
+		}
+	}
+
+	switch (rule->policy) {
+	case WL_CLIENT_FLUSH_END_OF_DISPATCH:
+		return;
+	case WL_CLIENT_FLUSH_IMMEDIATE:
+		ret = client_flush_counted(client,
+					   &client->flush_stats.immediate);
+		break;
+	case WL_CLIENT_FLUSH_THRESHOLD:
+		if (wl_connection_pending_output(client->connection) <
+		    rule->param)
+			return;
+		ret = client_flush_counted(client,
+					   &client->flush_stats.threshold);
+		break;
+	case WL_CLIENT_FLUSH_DEADLINE:
+		client_arm_flush_deadline(client, rule->param);
+		return;
+	default:
+		return;
+	}
+
+	if (ret < 0 && errno != EAGAIN)
+		client->error = 1;
+}
+
 WL_EXPORT void
 wl_resource_post_event_array(struct wl_resource *resource, uint32_t opcode,
 			     union wl_argument *args)
 {
-	struct wl_closure *closure;
+	struct wl_closure closure;
 	struct wl_object *object = &resource->object;
 
-	closure = wl_closure_marshal(object, opcode, args,
-				     &object->interface->events[opcode]);
-
-	if (closure == NULL) {
+	if (wl_closure_init_marshal(&closure, object, opcode, args,
+				    &object->interface->events[opcode]) < 0) {
 		resource->client->error = 1;
 		return;
 	}
 
-	if (wl_closure_send(closure, resource->client->connection))
+	if (wl_closure_send(&closure, resource->client->connection))
 		resource->client->error = 1;
 
 	if (debug_server)
-		wl_closure_print(closure, object, true);
+		wl_closure_print(&closure, object, true);
 
-	wl_closure_destroy(closure);
+	client_mark_dirty(resource->client);
+	client_event_posted(resource->client, object->interface);
 }
 
 WL_EXPORT void
@@ -177,24 +293,20 @@ WL_EXPORT void
 wl_resource_queue_event_array(struct wl_resource *resource, uint32_t opcode,
 			      union wl_argument *args)
 {
-	struct wl_closure *closure;
+	struct wl_closure closure;
 	struct wl_object *object = &resource->object;
 
-	closure = wl_closure_marshal(object, opcode, args,
-				     &object->interface->events[opcode]);
-
-	if (closure == NULL) {
+	if (wl_closure_init_marshal(&closure, object, opcode, args,
+				    &object->interface->events[opcode]) < 0) {
 		resource->client->error = 1;
 		return;
 	}
 
-	if (wl_closure_queue(closure, resource->client->connection))
+	if (wl_closure_queue(&closure, resource->client->connection))
 		resource->client->error = 1;
 
 	if (debug_server)
-		wl_closure_print(closure, object, true);
-
-	wl_closure_destroy(closure);
+		wl_closure_print(&closure, object, true);
 }
 
 WL_EXPORT void
@@ -241,45 +353,66 @@ wl_resource_post_error(struct wl_resource *resource,
 }
 
 static int
-wl_client_connection_data(int fd, uint32_t mask, void *data)
+client_dispatch_requests(struct wl_client *client, int len);
+static void
+client_drain_requests(struct wl_client *client);
+
+static void
+client_deferred_requests(void *data)
 {
 	struct wl_client *client = data;
+
+	/* The idle source is removed once we return. */
+	client->deferred_source = NULL;
+
+	if (client_dispatch_requests(client,
+				     wl_connection_pending_input(client->connection)) < 0)
+		return;
+
+	/* An edge-triggered source won't report the data we left in the
+	 * socket while requests were deferred, so pick it up here. */
+	if (client->edge_triggered && client->deferred_source == NULL)
+		client_drain_requests(client);
+}
+
+static int
+client_defer_requests(struct wl_client *client, int len)
+{
+	struct wl_event_loop *loop = client->display->loop;
+
+	client->deferred_source =
+		wl_event_loop_add_idle(loop, client_deferred_requests, client);
+	if (client->deferred_source == NULL)
+		return -1;
+
+	client->request_stats.deferrals++;
+	if ((uint32_t) len > client->request_stats.max_deferred_bytes)
+		client->request_stats.max_deferred_bytes = len;
+
+	return 0;
+}
+
+/* Returns -1 if the client was destroyed. */
+static int
+client_dispatch_requests(struct wl_client *client, int len)
+{
 	struct wl_connection *connection = client->connection;
 	struct wl_resource *resource;
 	struct wl_object *object;
 	struct wl_closure *closure;
 	const struct wl_message *message;
+	const struct wl_message_desc *desc;
+	struct wl_message_desc desc_storage;
 	uint32_t p[2];
-	uint32_t resource_flags;
+	uint32_t resource_flags, count = 0;
 	int opcode, size;
-	int len;
-
-	if (mask & (WL_EVENT_ERROR | WL_EVENT_HANGUP)) {
-		wl_client_destroy(client);
-		return 1;
-	}
-
-	if (mask & WL_EVENT_WRITABLE) {
-		len = wl_connection_flush(connection);
-		if (len < 0 && errno != EAGAIN) {
-			wl_client_destroy(client);
-			return 1;
-		} else if (len >= 0) {
-			wl_event_source_fd_update(client->source,
-						  WL_EVENT_READABLE);
-		}
-	}
-
-	len = 0;
-	if (mask & WL_EVENT_READABLE) {
-		len = wl_connection_read(connection);
-		if (len <= 0 && errno != EAGAIN) {
-			wl_client_destroy(client);
-			return 1;
-		}
-	}
 
 	while ((size_t) len >= sizeof p) {
+		if (client->request_budget > 0 &&
+		    count >= client->request_budget &&
+		    client_defer_requests(client, len) == 0)
+			break;
+
 		wl_connection_copy(connection, p, sizeof p);
 		opcode = p[1] & 0xffff;
 		size = p[1] >> 16;
@@ -307,9 +440,10 @@ wl_client_connection_data(int fd, uint32_t mask, void *data)
 		}
 
 		message = &object->interface->methods[opcode];
+		desc = wl_message_get_desc(message, &desc_storage);
 		if (!(resource_flags & WL_MAP_ENTRY_LEGACY) &&
 		    resource->version > 0 &&
-		    resource->version < wl_message_get_since(message)) {
+		    resource->version < desc->since) {
 			wl_resource_post_error(client->display_resource,
 					       WL_DISPLAY_ERROR_INVALID_METHOD,
 					       "invalid method %d, object %s@%u",
@@ -320,11 +454,16 @@ wl_client_connection_data(int fd, uint32_t mask, void *data)
 		}
 
 
-		closure = wl_connection_demarshal(client->connection, size,
-						  &client->objects, message);
+		/* The closure is destroyed right after dispatch, so its
+		 * arguments can point into the input buffer as long as the
+		 * message is only consumed after that. */
+		closure = wl_connection_demarshal_in_place(connection, size,
+							   &client->objects,
+							   message, desc);
 		len -= size;
 
 		if (closure == NULL && errno == ENOMEM) {
+			wl_connection_consume(connection, size);
 			wl_resource_post_no_memory(resource);
 			break;
 		} else if (closure == NULL ||
@@ -336,6 +475,7 @@ wl_client_connection_data(int fd, uint32_t mask, void *data)
 					       object->id,
 					       message->name);
 			wl_closure_destroy(closure);
+			wl_connection_consume(connection, size);
 			break;
 		}
 
@@ -352,13 +492,83 @@ wl_client_connection_data(int fd, uint32_t mask, void *data)
 		}
 
 		wl_closure_destroy(closure);
+		wl_connection_consume(connection, size);
+		count++;
 
 		if (client->error)
 			break;
 	}
 
-	if (client->error)
+	client->request_stats.requests += count;
+
+	if (client->error) {
+		wl_client_destroy(client);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Read and dispatch requests, then keep reading while the connection's
+ * read budget allows, so a burst is handled within one wakeup.  Edge-
+ * triggered sources aren't reported again until more data arrives, so
+ * for those the socket is read until it's empty.  Either way, stop
+ * once the request budget defers the rest. */
+static void
+client_drain_requests(struct wl_client *client)
+{
+	struct wl_connection *connection = client->connection;
+	int len;
+
+	wl_connection_begin_read(connection);
+	while (client->deferred_source == NULL) {
+		len = wl_connection_read(connection);
+		if (len < 0 && errno == EAGAIN)
+			break;
+		if (len <= 0) {
+			wl_client_destroy(client);
+			break;
+		}
+
+		if (client_dispatch_requests(client, len) < 0)
+			break;
+
+		if (!client->edge_triggered &&
+		    !wl_connection_read_more(connection))
+			break;
+	}
+}
+
+static int
+wl_client_connection_data(int fd, uint32_t mask, void *data)
+{
+	struct wl_client *client = data;
+	struct wl_connection *connection = client->connection;
+	int len;
+
+	if (mask & (WL_EVENT_ERROR | WL_EVENT_HANGUP)) {
 		wl_client_destroy(client);
+		return 1;
+	}
+
+	if (mask & WL_EVENT_WRITABLE) {
+		len = wl_connection_flush(connection);
+		if (len < 0 && errno != EAGAIN) {
+			wl_client_destroy(client);
+			return 1;
+		} else if (len >= 0) {
+			wl_event_source_fd_update(client->source,
+						  WL_EVENT_READABLE);
+		}
+	}
+
+	/* Requests deferred from an earlier dispatch are handled from an
+	 * idle source first; leave new data in the socket until then. */
+	if (client->deferred_source)
+		return 1;
+
+	if (mask & WL_EVENT_READABLE)
+		client_drain_requests(client);
 
 	return 1;
 }
@@ -377,7 +587,229 @@ wl_client_connection_data(int fd, uint32_t mask, void *data)
 WL_EXPORT void
 wl_client_flush(struct wl_client *client)
 {
-	wl_connection_flush(client->connection);
+	client_flush_counted(client, &client->flush_stats.manual);
+}
+
+static int
+client_flush_deadline(void *data)
+{
+	struct wl_client *client = data;
+
+	client->flush_timer_armed = 0;
+	if (client_flush_counted(client, &client->flush_stats.deadline) < 0 &&
+	    errno != EAGAIN)
+		wl_client_destroy(client);
+
+	return 1;
+}
+
+/** Set when events posted to a client are flushed to its socket
+ *
+ * \param client The client object
+ * \param interface Apply the policy to events on objects of this
+ * interface only, or NULL to set the default for the client
+ * \param policy The flush policy
+ * \param param The byte threshold for \c WL_CLIENT_FLUSH_THRESHOLD or
+ * the delay in milliseconds for \c WL_CLIENT_FLUSH_DEADLINE, ignored
+ * otherwise
+ * \return 0 on success, -1 if a deadline timer couldn't be created
+ *
+ * By default events sit in the client's outgoing buffer until
+ * wl_display_flush_clients() runs before the event loop blocks again.
+ * Latency critical events, such as input, can be flushed as soon as
+ * they are posted, while bulk traffic can be batched up to a size or
+ * a time limit.  Events sent with wl_resource_queue_event() never
+ * trigger a flush.
+ *
+ * \sa wl_client_get_flush_stats()
+ *
+ * \memberof wl_client
+ */
+WL_EXPORT int
+wl_client_set_flush_policy(struct wl_client *client,
+			   const struct wl_interface *interface,
+			   enum wl_client_flush_policy policy,
+			   uint32_t param)
+{
+	struct wl_client_flush_rule *rule;
+
+	if (policy == WL_CLIENT_FLUSH_DEADLINE && client->flush_timer == NULL) {
+		client->flush_timer =
+			wl_event_loop_add_timer(client->display->loop,
+						client_flush_deadline, client);
+		if (client->flush_timer == NULL)
+			return -1;
+	}
+
+	if (interface == NULL) {
+		rule = &client->flush_rule;
+	} else {
+		wl_array_for_each(rule, &client->flush_rules)
+			if (rule->interface == interface)
+				break;
+
+		if ((char *) rule == (char *) client->flush_rules.data +
+		    client->flush_rules.size) {
+			rule = wl_array_add(&client->flush_rules, sizeof *rule);
+			if (rule == NULL)
+				return -1;
+		}
+	}
+
+	rule->interface = interface;
+	rule->policy = policy;
+	rule->param = param;
+
+	return 0;
+}
+
+/** Limit the number of requests handled per dispatch for a client
+ *
+ * \param client The client object
+ * \param budget The maximum number of requests, or 0 for no limit
+ *
+ * By default all complete requests read from a client are dispatched
+ * in one go, so a client flooding the compositor with requests can
+ * delay everybody else.  With a budget, requests beyond it are left in
+ * the connection buffer and dispatched from an idle source on the next
+ * event loop iteration, after other clients have had their turn.
+ *
+ * \sa wl_display_set_default_request_budget(), wl_client_get_request_stats()
+ *
+ * \memberof wl_client
+ */
+WL_EXPORT void
+wl_client_set_request_budget(struct wl_client *client, uint32_t budget)
+{
+	client->request_budget = budget;
+}
+
+/** Limit the number of bytes read from a client per wakeup
+ *
+ * \param client The client object
+ * \param budget The number of bytes, or 0 to read only once
+ *
+ * When a client's socket becomes readable, its requests are read and
+ * dispatched, and the socket is read again as long as the previous
+ * read filled the connection buffer and fewer than \c budget bytes
+ * have been read.  A burst larger than the connection buffer is then
+ * handled within a single wakeup instead of one event loop iteration
+ * per buffer full.  Sockets in edge-triggered mode are always read
+ * until they would block.  The default is 64 KiB.
+ *
+ * \sa wl_display_set_default_read_budget(), wl_client_get_read_stats()
+ *
+ * \memberof wl_client
+ */
+WL_EXPORT void
+wl_client_set_read_budget(struct wl_client *client, uint32_t budget)
+{
+	wl_connection_set_read_budget(client->connection, budget);
+}
+
+/** Retrieve the socket read counters of a client
+ *
+ * \param client The client object
+ * \param stats Filled in with the current counters
+ *
+ * \sa wl_client_set_read_budget()
+ *
+ * \memberof wl_client
+ */
+WL_EXPORT void
+wl_client_get_read_stats(struct wl_client *client,
+			 struct wl_connection_read_stats *stats)
+{
+	wl_connection_get_read_stats(client->connection, stats);
+}
+
+/** Retrieve the file descriptor passing counters of a client
+ *
+ * \param client The client object
+ * \param stats Filled in with the current counters
+ *
+ * \memberof wl_client
+ */
+WL_EXPORT void
+wl_client_get_fd_stats(struct wl_client *client,
+		       struct wl_connection_fd_stats *stats)
+{
+	wl_connection_get_fd_stats(client->connection, stats);
+}
+
+/** Retrieve request dispatch counters of a client
+ *
+ * \param client The client object
+ * \param stats Filled in with the current counters
+ *
+ * \sa wl_client_set_request_budget()
+ *
+ * \memberof wl_client
+ */
+WL_EXPORT void
+wl_client_get_request_stats(struct wl_client *client,
+			    struct wl_client_request_stats *stats)
+{
+	*stats = client->request_stats;
+}
+
+/** Retrieve the flush counters of a client
+ *
+ * \param client The client object
+ * \param stats Filled in with the number of flushes, by reason
+ *
+ * Only flushes that wrote data to the socket are counted.
+ *
+ * \sa wl_client_set_flush_policy()
+ *
+ * \memberof wl_client
+ */
+WL_EXPORT void
+wl_client_get_flush_stats(struct wl_client *client,
+			  struct wl_client_flush_stats *stats)
+{
+	*stats = client->flush_stats;
+	stats->overflow = wl_connection_get_overflow_flushes(client->connection);
+}
+
+/** Set the maximum size of the client's connection buffers
+ *
+ * \param client The client object
+ * \param max_buffer_size The maximum size in bytes
+ *
+ * The buffers holding incoming requests and outgoing events start out
+ * at 4096 bytes and grow on demand, in powers of two, up to this limit.
+ * Once the outgoing buffer can't grow any further, queuing more events
+ * forces a flush to the socket, and an event larger than the limit
+ * fails with E2BIG.  The value is rounded up to a power of two and
+ * values smaller than 4096 are treated as 4096.
+ *
+ * \sa wl_display_set_default_max_buffer_size()
+ *
+ * \memberof wl_client
+ */
+WL_EXPORT void
+wl_client_set_max_buffer_size(struct wl_client *client, size_t max_buffer_size)
+{
+	wl_connection_set_max_buffer_size(client->connection, max_buffer_size);
+}
+
+/** Retrieve closure allocator statistics for a client
+ *
+ * \param client The client object
+ * \param stats Filled in with the current statistics
+ *
+ * Requests are demarshalled into closures that are recycled through a
+ * small free list on the client connection.  This returns the hit,
+ * miss and high-water counters of that free list.
+ *
+ * \memberof wl_client
+ */
+WL_EXPORT void
+wl_client_get_closure_pool_stats(struct wl_client *client,
+				 struct wl_closure_pool_stats *stats)
+{
+	wl_connection_get_closure_pool_stats(client->connection, stats);
 }
 
 /** Get the display object for the given client
@@ -430,13 +862,21 @@ wl_client_create(struct wl_display *display, int fd)
 
 	memset(client, 0, sizeof *client);
 	client->display = display;
+	client->edge_triggered = display->edge_triggered;
 	client->source = wl_event_loop_add_fd(display->loop, fd,
-					      WL_EVENT_READABLE,
+					      WL_EVENT_READABLE |
+					      (client->edge_triggered ?
+					       WL_EVENT_EDGE_TRIGGERED : 0),
 					      wl_client_connection_data, client);
 
 	if (!client->source)
 		goto err_client;
 
+	/* Let the compositor's own fds, input in particular, go first
+	 * when a wakeup has both. */
+	wl_event_source_set_priority(client->source,
+				     WL_EVENT_SOURCE_PRIORITY_BULK);
+
 #if defined(SO_PEERCRED)
 	/* Linux */
 	len = sizeof client->ucred;
@@ -456,11 +896,19 @@ wl_client_create(struct wl_display *display, int fd)
 	if (client->connection == NULL)
 		goto err_source;
 
+	wl_connection_set_max_buffer_size(client->connection,
+					  display->max_buffer_size);
+	client->request_budget = display->request_budget;
+	wl_connection_set_read_budget(client->connection,
+				      display->read_budget);
+
 	wl_map_init(&client->objects, WL_MAP_SERVER_SIDE);
 
 	if (wl_map_insert_at(&client->objects, 0, 0, NULL) < 0)
 		goto err_map;
 
+	wl_array_init(&client->flush_rules);
+	wl_list_init(&client->flush_link);
 	wl_signal_init(&client->destroy_signal);
 	if (bind_display(client, display) < 0)
 		goto err_map;
@@ -704,7 +1152,13 @@ wl_client_destroy(struct wl_client *client)
 	wl_map_for_each(&client->objects, destroy_resource, &serial);
 	wl_map_release(&client->objects);
 	wl_event_source_remove(client->source);
+	if (client->flush_timer)
+		wl_event_source_remove(client->flush_timer);
+	if (client->deferred_source)
+		wl_event_source_remove(client->deferred_source);
+	wl_array_release(&client->flush_rules);
 	wl_connection_destroy(client->connection);
+	wl_list_remove(&client->flush_link);
 	wl_list_remove(&client->link);
 	free(client);
 }
@@ -777,9 +1231,10 @@ display_get_registry(struct wl_client *client,
 		return;
 	}
 
-	wl_resource_set_implementation(registry_resource,
-				       &registry_interface,
-				       display, unbind_resource);
+	wl_resource_set_dispatcher(registry_resource,
+				   wl_registry_interface_dispatcher,
+				   &registry_interface,
+				   display, unbind_resource);
 
 	wl_list_insert(&display->registry_resource_list,
 		       &registry_resource->link);
@@ -813,9 +1268,10 @@ bind_display(struct wl_client *client, struct wl_display *display)
 		return -1;
 	}
 
-	wl_resource_set_implementation(client->display_resource,
-				       &display_interface, display,
-				       destroy_client_display_resource);
+	wl_resource_set_dispatcher(client->display_resource,
+				   wl_display_interface_dispatcher,
+				   &display_interface, display,
+				   destroy_client_display_resource);
 	return 0;
 }
 
@@ -851,12 +1307,17 @@ wl_display_create(void)
 	wl_list_init(&display->global_list);
 	wl_list_init(&display->socket_list);
 	wl_list_init(&display->client_list);
+	wl_list_init(&display->flush_list);
 	wl_list_init(&display->registry_resource_list);
 
 	wl_signal_init(&display->destroy_signal);
 
 	display->id = 1;
 	display->serial = 0;
+	display->max_buffer_size = 0;
+	display->request_budget = 0;
+	display->read_budget = WL_CONNECTION_DEFAULT_READ_BUDGET;
+	display->edge_triggered = 0;
 
 	wl_array_init(&display->additional_shm_formats);
 
@@ -1024,21 +1485,109 @@ wl_display_run(struct wl_display *display)
 WL_EXPORT void
 wl_display_flush_clients(struct wl_display *display)
 {
-	struct wl_client *client, *next;
+	struct wl_client *client;
+	struct wl_list dirty;
 	int ret;
 
-	wl_list_for_each_safe(client, next, &display->client_list, link) {
-		ret = wl_connection_flush(client->connection);
-		if (ret < 0 && errno == EAGAIN) {
-			wl_event_source_fd_update(client->source,
-						  WL_EVENT_WRITABLE |
-						  WL_EVENT_READABLE);
-		} else if (ret < 0) {
+	/* Take the whole list first; clients that can't be flushed
+	 * completely are put back for the next pass. */
+	wl_list_init(&dirty);
+	wl_list_insert_list(&dirty, &display->flush_list);
+	wl_list_init(&display->flush_list);
+
+	while (!wl_list_empty(&dirty)) {
+		client = container_of(dirty.next, struct wl_client, flush_link);
+		wl_list_remove(&client->flush_link);
+		wl_list_init(&client->flush_link);
+
+		ret = client_flush_counted(client,
+					   &client->flush_stats.dispatch);
+		if (ret < 0 && errno == EAGAIN)
+			client_mark_dirty(client);
+		else if (ret < 0)
 			wl_client_destroy(client);
-		}
 	}
 }
 
+/** Set the default maximum connection buffer size for new clients
+ *
+ * \param display The display object
+ * \param max_buffer_size The maximum size in bytes
+ *
+ * Clients created after this call get connection buffers that can
+ * grow up to \c max_buffer_size bytes.  Clients that already exist are
+ * not affected; use wl_client_set_max_buffer_size() for those.
+ *
+ * \memberof wl_display
+ */
+WL_EXPORT void
+wl_display_set_default_max_buffer_size(struct wl_display *display,
+				       size_t max_buffer_size)
+{
+	display->max_buffer_size = max_buffer_size;
+}
+
+/** Set the default request budget for new clients
+ *
+ * \param display The display object
+ * \param budget The maximum number of requests dispatched per event
+ * loop iteration, or 0 for no limit
+ *
+ * Applies to clients created after this call.
+ *
+ * \sa wl_client_set_request_budget()
+ *
+ * \memberof wl_display
+ */
+WL_EXPORT void
+wl_display_set_default_request_budget(struct wl_display *display,
+				      uint32_t budget)
+{
+	display->request_budget = budget;
+}
+
+/** Set the default read budget for new clients
+ *
+ * \param display The display object
+ * \param budget The number of bytes read from a client per wakeup, or
+ * 0 to read only once
+ *
+ * Applies to clients created after this call.
+ *
+ * \sa wl_client_set_read_budget()
+ *
+ * \memberof wl_display
+ */
+WL_EXPORT void
+wl_display_set_default_read_budget(struct wl_display *display,
+				   uint32_t budget)
+{
+	display->read_budget = budget;
+}
+
+/** Watch client sockets in edge-triggered mode
+ *
+ * \param display The display object
+ * \param enabled Nonzero to register new client sockets with
+ * \c WL_EVENT_EDGE_TRIGGERED
+ *
+ * Client sockets are then reported once per batch of incoming data
+ * instead of on every loop iteration while data is pending, and the
+ * server reads each socket until it would block.  Together with the
+ * cached interest mask in wl_event_source_fd_update() this keeps
+ * congested clients from costing extra epoll_ctl() calls per frame.
+ *
+ * Applies to clients created after this call.
+ *
+ * \memberof wl_display
+ */
+WL_EXPORT void
+wl_display_set_client_edge_triggered(struct wl_display *display,
+				     int enabled)
+{
+	display->edge_triggered = !!enabled;
+}
+
 static int
 socket_data(int fd, uint32_t mask, void *data)
 {
@@ -36,13 +36,27 @@ enum {
 	WL_EVENT_READABLE = 0x01,
 	WL_EVENT_WRITABLE = 0x02,
 	WL_EVENT_HANGUP   = 0x04,
-	WL_EVENT_ERROR    = 0x08
+	WL_EVENT_ERROR    = 0x08,
+	/* Only valid when adding an fd source: report readiness once per
+	 * change instead of for as long as the fd stays ready. */
+	WL_EVENT_EDGE_TRIGGERED = 0x10
+};
+
+enum wl_event_source_priority {
+	WL_EVENT_SOURCE_PRIORITY_INPUT,
+	WL_EVENT_SOURCE_PRIORITY_DISPLAY,
+	WL_EVENT_SOURCE_PRIORITY_DEFAULT,
+	WL_EVENT_SOURCE_PRIORITY_BULK,
+	WL_EVENT_SOURCE_PRIORITY_COUNT
 };
 
 struct wl_event_loop;
 struct wl_event_source;
+struct timespec;
 typedef int (*wl_event_loop_fd_func_t)(int fd, uint32_t mask, void *data);
 typedef int (*wl_event_loop_timer_func_t)(void *data);
+typedef int (*wl_event_loop_timer_deadline_func_t)(uint64_t expirations,
+						   void *data);
 typedef int (*wl_event_loop_signal_func_t)(int signal_number, void *data);
 typedef void (*wl_event_loop_idle_func_t)(void *data);
 
@@ -62,18 +76,107 @@ wl_event_loop_add_signal(struct wl_event_loop *loop,
 			wl_event_loop_signal_func_t func,
 			void *data);
 
+struct wl_event_source *
+wl_event_loop_add_timer_deadline(struct wl_event_loop *loop,
+				 wl_event_loop_timer_deadline_func_t func,
+				 void *data);
+
 int wl_event_source_timer_update(struct wl_event_source *source,
 				 int ms_delay);
+int wl_event_source_timer_set_deadline(struct wl_event_source *source,
+				       const struct timespec *deadline,
+				       uint64_t slack_ns);
+int wl_event_source_timer_set_interval(struct wl_event_source *source,
+				       uint64_t interval_ns);
 int wl_event_source_remove(struct wl_event_source *source);
 void wl_event_source_check(struct wl_event_source *source);
+int wl_event_source_set_priority(struct wl_event_source *source,
+				 enum wl_event_source_priority priority);
 
 
 int wl_event_loop_dispatch(struct wl_event_loop *loop, int timeout);
 void wl_event_loop_dispatch_idle(struct wl_event_loop *loop);
+int wl_event_loop_post(struct wl_event_loop *loop,
+		       wl_event_loop_idle_func_t func,
+		       void *data);
 struct wl_event_source *wl_event_loop_add_idle(struct wl_event_loop *loop,
 					       wl_event_loop_idle_func_t func,
 					       void *data);
+struct wl_event_source *wl_event_loop_create_idle(struct wl_event_loop *loop,
+						  wl_event_loop_idle_func_t func,
+						  void *data);
+int wl_event_source_idle_update(struct wl_event_source *source, int armed);
 int wl_event_loop_get_fd(struct wl_event_loop *loop);
+const char *wl_event_loop_get_backend(struct wl_event_loop *loop);
+
+struct wl_event_loop_stats {
+	/* Returns from epoll_wait()/kevent(), including timeouts */
+	uint64_t wakeups;
+	/* Events fetched over all wakeups */
+	uint64_t events;
+	/* Most events fetched by a single wakeup */
+	uint32_t max_events_per_wakeup;
+	/* Wakeups that filled the whole batch */
+	uint32_t full_batches;
+	/* Batch size used by the last wakeup */
+	uint32_t batch_size;
+	/* wl_event_source_fd_update() calls that reached the kernel */
+	uint64_t fd_updates;
+	/* Calls that matched the current mask and were skipped */
+	uint64_t fd_updates_skipped;
+	/* Tasks run from wl_event_loop_post() */
+	uint64_t posted_tasks;
+	/* Dispatches that found posted tasks */
+	uint64_t post_wakeups;
+	/* Events left for the next wakeup by the preempt budget */
+	uint64_t preempted_events;
+	/* Passes over the check sources, summed over all dispatches */
+	uint64_t check_passes;
+	/* Most passes a single dispatch needed */
+	uint32_t max_check_passes;
+	/* Dispatches that stopped at the pass limit */
+	uint32_t capped_checks;
+};
+
+void wl_event_loop_set_max_events(struct wl_event_loop *loop, int max_events);
+void wl_event_loop_set_preempt_budget(struct wl_event_loop *loop,
+				      uint32_t budget_us);
+void wl_event_loop_set_max_check_passes(struct wl_event_loop *loop,
+					int max_passes);
+void wl_event_loop_get_stats(struct wl_event_loop *loop,
+			     struct wl_event_loop_stats *stats);
+
+/* Callback durations are counted in buckets of powers of four, the
+ * first holding those under 16us and the last everything from 16ms. */
+#define WL_EVENT_SOURCE_PROFILE_BUCKETS 7
+
+struct wl_event_source_profile {
+	/* Callbacks run while profiling was on */
+	uint64_t dispatches;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint32_t histogram[WL_EVENT_SOURCE_PROFILE_BUCKETS];
+};
+
+struct wl_event_loop_profile {
+	/* Time from the loop waking up to each fd, timer or signal
+	 * callback starting */
+	uint64_t latency_samples;
+	uint64_t latency_total_ns;
+	uint64_t latency_max_ns;
+	/* Time spent in fd, timer and signal callbacks */
+	uint64_t dispatch_ns;
+	/* Time spent in post-dispatch checks */
+	uint64_t check_ns;
+	/* Time spent in idle callbacks */
+	uint64_t idle_ns;
+};
+
+void wl_event_loop_set_profiling(struct wl_event_loop *loop, int enabled);
+void wl_event_loop_get_profile(struct wl_event_loop *loop,
+			       struct wl_event_loop_profile *profile);
+void wl_event_source_get_profile(struct wl_event_source *source,
+				 struct wl_event_source_profile *profile);
 
 struct wl_client;
 struct wl_display;
@@ -96,6 +199,14 @@ const char *wl_display_add_socket_auto(struct wl_display *display);
 void wl_display_terminate(struct wl_display *display);
 void wl_display_run(struct wl_display *display);
 void wl_display_flush_clients(struct wl_display *display);
+void wl_display_set_default_max_buffer_size(struct wl_display *display,
+					    size_t max_buffer_size);
+void wl_display_set_default_request_budget(struct wl_display *display,
+					   uint32_t budget);
+void wl_display_set_default_read_budget(struct wl_display *display,
+					uint32_t budget);
+void wl_display_set_client_edge_triggered(struct wl_display *display,
+					  int enabled);
 
 typedef void (*wl_global_bind_func_t)(struct wl_client *client, void *data,
 				      uint32_t version, uint32_t id);
@@ -114,9 +225,75 @@ struct wl_global *wl_global_create(struct wl_display *display,
 				   void *data, wl_global_bind_func_t bind);
 void wl_global_destroy(struct wl_global *global);
 
+/**
+ * When events posted to a client are written to its socket.
+ *
+ * Regardless of policy, events are also flushed when the outgoing
+ * buffer is full, on wl_client_flush() and by
+ * wl_display_flush_clients().
+ */
+enum wl_client_flush_policy {
+	/** Wait for the next wl_display_flush_clients() (default) */
+	WL_CLIENT_FLUSH_END_OF_DISPATCH = 0,
+	/** Flush as soon as the event is posted */
+	WL_CLIENT_FLUSH_IMMEDIATE,
+	/** Flush once at least \c param bytes are pending */
+	WL_CLIENT_FLUSH_THRESHOLD,
+	/** Flush at most \c param milliseconds after the event is posted */
+	WL_CLIENT_FLUSH_DEADLINE
+};
+
+/**
+ * Number of times a client connection was flushed, by reason.
+ */
+struct wl_client_flush_stats {
+	/** Event posted under WL_CLIENT_FLUSH_IMMEDIATE */
+	uint32_t immediate;
+	/** Pending bytes reached a WL_CLIENT_FLUSH_THRESHOLD */
+	uint32_t threshold;
+	/** A WL_CLIENT_FLUSH_DEADLINE timer expired */
+	uint32_t deadline;
+	/** wl_display_flush_clients() */
+	uint32_t dispatch;
+	/** The outgoing buffer was full */
+	uint32_t overflow;
+	/** wl_client_flush() */
+	uint32_t manual;
+};
+
+/**
+ * Request dispatch counters of a client.
+ */
+struct wl_client_request_stats {
+	/** Requests dispatched */
+	uint32_t requests;
+	/** Times the request budget ran out with requests still pending */
+	uint32_t deferrals;
+	/** Largest number of bytes left pending by a deferral */
+	uint32_t max_deferred_bytes;
+};
+
 struct wl_client *wl_client_create(struct wl_display *display, int fd);
 void wl_client_destroy(struct wl_client *client);
 void wl_client_flush(struct wl_client *client);
+int wl_client_set_flush_policy(struct wl_client *client,
+			       const struct wl_interface *interface,
+			       enum wl_client_flush_policy policy,
+			       uint32_t param);
+void wl_client_get_flush_stats(struct wl_client *client,
+			       struct wl_client_flush_stats *stats);
+void wl_client_set_request_budget(struct wl_client *client, uint32_t budget);
+void wl_client_get_request_stats(struct wl_client *client,
+				 struct wl_client_request_stats *stats);
+void wl_client_set_read_budget(struct wl_client *client, uint32_t budget);
+void wl_client_get_read_stats(struct wl_client *client,
+			      struct wl_connection_read_stats *stats);
+void wl_client_get_fd_stats(struct wl_client *client,
+			    struct wl_connection_fd_stats *stats);
+void wl_client_set_max_buffer_size(struct wl_client *client,
+				   size_t max_buffer_size);
+void wl_client_get_closure_pool_stats(struct wl_client *client,
+				     struct wl_closure_pool_stats *stats);
 void wl_client_get_credentials(struct wl_client *client,
 			       pid_t *pid, uid_t *uid, gid_t *gid);
 
@@ -344,8 +521,6 @@ void wl_resource_post_error(struct wl_resource *resource,
 	__attribute__ ((format (printf, 3, 4)));
 void wl_resource_post_no_memory(struct wl_resource *resource);
 
-#include "wayland-server-protocol.h"
-
 struct wl_display *
 wl_client_get_display(struct wl_client *client);
 
@@ -398,6 +573,10 @@ struct wl_listener *
 wl_resource_get_destroy_listener(struct wl_resource *resource,
 				 wl_notify_func_t notify);
 
+/* Included after the resource API, since the generated dispatchers
+ * and event wrappers use it. */
+#include "wayland-server-protocol.h"
+
 #define wl_resource_for_each(resource, list)					\
 	for (resource = 0, resource = wl_resource_from_link((list)->next);	\
 	     wl_resource_get_link(resource) != (list);				\
@@ -283,6 +283,51 @@ typedef int (*wl_dispatcher_func_t)(const void *, void *, uint32_t,
 				    const struct wl_message *,
 				    union wl_argument *);
 
+/**
+ * \brief Statistics for the per-connection closure allocator.
+ *
+ * Incoming messages are demarshalled into closures that are recycled
+ * through a small per-connection free list.  These counters show how
+ * well the free list covers the message traffic of a connection.
+ */
+struct wl_closure_pool_stats {
+	uint32_t hits; /**< allocations served from the free list */
+	uint32_t misses; /**< allocations that had to call malloc */
+	uint32_t in_use; /**< closures currently allocated */
+	uint32_t high_water; /**< largest value in_use has reached */
+	uint32_t in_place; /**< messages parsed directly from the input buffer */
+	uint32_t copied; /**< messages copied out of the input buffer first */
+};
+
+/**
+ * \brief Statistics for reads from a connection's socket.
+ *
+ * Each time a connection is found readable, its socket is read until
+ * it runs dry or the connection's read budget is spent, with the
+ * messages that arrived handled between reads.  Dividing reads by
+ * wakeups and bytes by reads shows how well one wakeup covers a burst.
+ */
+struct wl_connection_read_stats {
+	uint32_t wakeups; /**< times the connection was found readable */
+	uint32_t reads; /**< reads that returned data */
+	uint64_t bytes; /**< bytes read in total */
+	uint32_t budget_hits; /**< wakeups that stopped at the read budget */
+};
+
+/**
+ * \brief File descriptor passing counters of a connection.
+ *
+ * Outgoing file descriptors are queued with the message that carries
+ * them and sent along with it, at most 28 per sendmsg().
+ */
+struct wl_connection_fd_stats {
+	uint32_t sent; /**< file descriptors sent */
+	uint32_t received; /**< file descriptors received */
+	uint32_t sends; /**< sendmsg() calls that carried file descriptors */
+	uint32_t queue_flushes; /**< flushes forced by a full fd queue */
+	uint32_t queue_high_water; /**< most file descriptors queued at once */
+};
+
 typedef void (*wl_log_func_t)(const char *, va_list) WL_PRINTF(1, 0);
 
 #ifdef  __cplusplus
@@ -87,3 +87,181 @@ TEST(client_destroy_listener)
 	wl_display_destroy(display);
 }
 
+
+TEST(client_flush_policy)
+{
+	struct wl_display *display;
+	struct wl_client *client;
+	struct wl_resource *callback;
+	struct wl_client_flush_stats stats;
+	char buf[64];
+	int s[2];
+
+	assert(wl_os_socketpair_cloexec(AF_UNIX, SOCK_STREAM, 0, s) == 0);
+	display = wl_display_create();
+	assert(display);
+	client = wl_client_create(display, s[0]);
+	assert(client);
+
+	callback = wl_resource_create(client, &wl_callback_interface, 1, 0);
+	assert(callback);
+
+	/* By default nothing is written until the display flushes. */
+	wl_callback_send_done(callback, 1);
+	assert(recv(s[1], buf, sizeof buf, MSG_DONTWAIT) == -1);
+	wl_display_flush_clients(display);
+	assert(recv(s[1], buf, sizeof buf, MSG_DONTWAIT) == 12);
+
+	/* Events are 12 bytes, so the second one crosses 20 bytes. */
+	assert(wl_client_set_flush_policy(client, NULL,
+					  WL_CLIENT_FLUSH_THRESHOLD, 20) == 0);
+	wl_callback_send_done(callback, 2);
+	assert(recv(s[1], buf, sizeof buf, MSG_DONTWAIT) == -1);
+	wl_callback_send_done(callback, 3);
+	assert(recv(s[1], buf, sizeof buf, MSG_DONTWAIT) == 24);
+
+	/* A per-interface rule overrides the client default. */
+	assert(wl_client_set_flush_policy(client, &wl_callback_interface,
+					  WL_CLIENT_FLUSH_IMMEDIATE, 0) == 0);
+	wl_callback_send_done(callback, 4);
+	assert(recv(s[1], buf, sizeof buf, MSG_DONTWAIT) == 12);
+
+	/* Deadline flushes are driven by the display's event loop. */
+	assert(wl_client_set_flush_policy(client, &wl_callback_interface,
+					  WL_CLIENT_FLUSH_DEADLINE, 1) == 0);
+	wl_callback_send_done(callback, 5);
+	assert(recv(s[1], buf, sizeof buf, MSG_DONTWAIT) == -1);
+	wl_event_loop_dispatch(wl_display_get_event_loop(display), 1000);
+	assert(recv(s[1], buf, sizeof buf, MSG_DONTWAIT) == 12);
+
+	wl_client_get_flush_stats(client, &stats);
+	assert(stats.dispatch == 1);
+	assert(stats.threshold == 1);
+	assert(stats.immediate == 1);
+	assert(stats.deadline == 1);
+	assert(stats.overflow == 0);
+	assert(stats.manual == 0);
+
+	wl_client_destroy(client);
+
+	close(s[0]);
+	close(s[1]);
+
+	wl_display_destroy(display);
+}
+
+TEST(client_request_budget)
+{
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+	struct wl_client *client;
+	struct wl_client_request_stats stats;
+	uint32_t requests[5][3];
+	int s[2], i;
+
+	assert(wl_os_socketpair_cloexec(AF_UNIX, SOCK_STREAM, 0, s) == 0);
+	display = wl_display_create();
+	assert(display);
+	loop = wl_display_get_event_loop(display);
+	wl_display_set_default_request_budget(display, 2);
+	client = wl_client_create(display, s[0]);
+	assert(client);
+
+	/* Five wl_display.sync (opcode 0) requests in a single write. */
+	for (i = 0; i < 5; i++) {
+		requests[i][0] = 1;
+		requests[i][1] = sizeof requests[i] << 16;
+		requests[i][2] = i + 2;
+	}
+	assert(write(s[1], requests, sizeof requests) == sizeof requests);
+
+	wl_event_loop_dispatch(loop, 0);
+	wl_client_get_request_stats(client, &stats);
+	assert(stats.requests == 2);
+	assert(stats.deferrals == 1);
+	assert(stats.max_deferred_bytes == 3 * sizeof requests[0]);
+
+	/* The rest is handled from idle sources on later iterations. */
+	wl_event_loop_dispatch(loop, 0);
+	wl_client_get_request_stats(client, &stats);
+	assert(stats.requests == 4);
+	assert(stats.deferrals == 2);
+
+	wl_event_loop_dispatch(loop, 0);
+	wl_client_get_request_stats(client, &stats);
+	assert(stats.requests == 5);
+	assert(stats.deferrals == 2);
+
+	wl_client_destroy(client);
+
+	close(s[0]);
+	close(s[1]);
+
+	wl_display_destroy(display);
+}
+
+TEST(client_read_budget)
+{
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+	struct wl_client *client;
+	struct wl_client_request_stats stats;
+	struct wl_connection_read_stats read_stats;
+	static uint32_t requests[1000][3];
+	int s[2], i;
+
+	assert(wl_os_socketpair_cloexec(AF_UNIX, SOCK_STREAM, 0, s) == 0);
+	display = wl_display_create();
+	assert(display);
+	loop = wl_display_get_event_loop(display);
+	client = wl_client_create(display, s[0]);
+	assert(client);
+
+	/* A burst of wl_display.sync requests, about three times the
+	 * size of the connection buffer. */
+	for (i = 0; i < 1000; i++) {
+		requests[i][0] = 1;
+		requests[i][1] = sizeof requests[i] << 16;
+		requests[i][2] = i + 2;
+	}
+	assert(write(s[1], requests, sizeof requests) == sizeof requests);
+
+	/* It's all read and dispatched within one wakeup. */
+	wl_event_loop_dispatch(loop, 0);
+	wl_client_get_request_stats(client, &stats);
+	assert(stats.requests == 1000);
+	wl_client_get_read_stats(client, &read_stats);
+	assert(read_stats.wakeups == 1);
+	assert(read_stats.reads == 3);
+	assert(read_stats.bytes == sizeof requests);
+	assert(read_stats.budget_hits == 0);
+
+	/* With a budget of one buffer, a wakeup stops after one read. */
+	for (i = 0; i < 1000; i++)
+		requests[i][2] = i + 1002;
+	assert(write(s[1], requests, sizeof requests) == sizeof requests);
+
+	wl_client_set_read_budget(client, 4096);
+	wl_event_loop_dispatch(loop, 0);
+	wl_client_get_request_stats(client, &stats);
+	assert(stats.requests == 1000 + 4096 / sizeof requests[0]);
+	wl_client_get_read_stats(client, &read_stats);
+	assert(read_stats.wakeups == 2);
+	assert(read_stats.reads == 4);
+	assert(read_stats.budget_hits == 1);
+
+	/* The socket is still readable, so the rest follows. */
+	while (stats.requests < 2000) {
+		wl_event_loop_dispatch(loop, 0);
+		wl_client_get_request_stats(client, &stats);
+	}
+	wl_client_get_read_stats(client, &read_stats);
+	assert(read_stats.bytes == 2 * sizeof requests);
+
+	wl_client_destroy(client);
+
+	close(s[0]);
+	close(s[1]);
+
+	wl_display_destroy(display);
+}
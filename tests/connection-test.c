@@ -121,6 +121,44 @@ TEST(connection_queue)
 	close(s[1]);
 }
 
+TEST(connection_queue_grow)
+{
+	struct wl_connection *connection;
+	int s[2], i;
+	char buffer[64];
+	char *big;
+	size_t size = 3 * 4096, too_big = 32768;
+
+	connection = setup(s);
+	wl_connection_set_max_buffer_size(connection, 16384);
+
+	/* Queue more than the initial 4096 byte ring; it should grow
+	 * instead of flushing, so nothing reaches the socket yet. */
+	for (i = 0; i < (int) (size / sizeof message) - 1; i++)
+		assert(wl_connection_queue(connection,
+					   message, sizeof message) == 0);
+	assert(wl_connection_write(connection, message, sizeof message) == 0);
+	assert(recv(s[1], buffer, sizeof buffer, MSG_DONTWAIT) == -1);
+	assert(errno == EAGAIN);
+
+	big = calloc(1, too_big);
+	assert(big);
+	i = wl_connection_flush(connection);
+	assert(i == (int) ((size / sizeof message) * sizeof message));
+	assert(read(s[1], big, size) == i);
+	assert(memcmp(big, message, sizeof message) == 0);
+
+	/* A single message may also exceed the default size now, but
+	 * not the configured maximum. */
+	assert(wl_connection_write(connection, big, size) == 0);
+	assert(wl_connection_write(connection, big, too_big) == -1);
+	assert(errno == E2BIG);
+
+	free(big);
+	wl_connection_destroy(connection);
+	close(s[1]);
+}
+
 struct marshal_data {
 	struct wl_connection *read_connection;
 	struct wl_connection *write_connection;
@@ -411,6 +449,156 @@ TEST(connection_demarshal)
 	release_marshal_data(&data);
 }
 
+static void
+demarshal_in_place(struct marshal_data *data, const char *format,
+		   uint32_t *msg, void (*func)(void))
+{
+	struct wl_message message = { "test", format, NULL };
+	struct wl_message_desc desc_storage;
+	const struct wl_message_desc *desc;
+	struct wl_closure *closure;
+	struct wl_map objects;
+	struct wl_object object = { NULL, &func, 0 };
+	int size = msg[1];
+
+	assert(write(data->s[1], msg, size) == size);
+	assert(wl_connection_read(data->read_connection) == size);
+
+	wl_map_init(&objects, WL_MAP_SERVER_SIDE);
+	object.id = msg[0];
+	desc = wl_message_get_desc(&message, &desc_storage);
+	closure = wl_connection_demarshal_in_place(data->read_connection,
+						   size, &objects, &message,
+						   desc);
+	assert(closure);
+	wl_closure_invoke(closure, WL_CLOSURE_INVOKE_SERVER, &object, 0, data);
+	wl_closure_destroy(closure);
+	wl_connection_consume(data->read_connection, size);
+}
+
+TEST(connection_demarshal_in_place)
+{
+	struct marshal_data data;
+	struct wl_closure_pool_stats stats;
+	uint32_t msg[10];
+	int i;
+
+	setup_marshal_data(&data);
+
+	data.value.s = "superdude";
+	msg[0] = 400200;
+	msg[1] = 24;
+	msg[2] = 10;
+	memcpy(&msg[3], data.value.s, msg[2]);
+	demarshal_in_place(&data, "s", msg, (void *) validate_demarshal_s);
+
+	wl_connection_get_closure_pool_stats(data.read_connection, &stats);
+	assert(stats.in_place == 1);
+	assert(stats.copied == 0);
+
+	/* Move the tail of the input buffer to 16 bytes before its
+	 * end, so the next string message wraps and has to be copied. */
+	for (i = 0; i < (4096 - 24 - 16) / 12; i++) {
+		data.value.u = i;
+		msg[0] = 400200;
+		msg[1] = 12;
+		msg[2] = data.value.u;
+		demarshal_in_place(&data, "u", msg,
+				   (void *) validate_demarshal_u);
+	}
+
+	data.value.s = "superdude";
+	msg[0] = 400200;
+	msg[1] = 24;
+	msg[2] = 10;
+	memcpy(&msg[3], data.value.s, msg[2]);
+	demarshal_in_place(&data, "s", msg, (void *) validate_demarshal_s);
+
+	wl_connection_get_closure_pool_stats(data.read_connection, &stats);
+	assert(stats.in_place == 1 + (4096 - 24 - 16) / 12);
+	assert(stats.copied == 1);
+
+	release_marshal_data(&data);
+}
+
+TEST(connection_demarshal_scalar)
+{
+	struct marshal_data data;
+	struct wl_message message = { "test", "uifo", NULL };
+	struct wl_message nullable = { "test", "uif?o", NULL };
+	struct wl_closure *closure;
+	struct wl_map objects;
+	uint32_t msg[6];
+
+	setup_marshal_data(&data);
+	wl_map_init(&objects, WL_MAP_SERVER_SIDE);
+
+	msg[0] = 400200;
+	msg[1] = 24 << 16;
+	msg[2] = 8000;
+	msg[3] = -557799;
+	msg[4] = wl_fixed_from_int(12);
+	msg[5] = 0;
+
+	/* A null id is only accepted for a nullable object. */
+	assert(write(data.s[1], msg, 24) == 24);
+	assert(wl_connection_read(data.read_connection) == 24);
+	closure = wl_connection_demarshal(data.read_connection, 24,
+					  &objects, &message);
+	assert(closure == NULL);
+	assert(errno == EINVAL);
+
+	assert(write(data.s[1], msg, 24) == 24);
+	assert(wl_connection_read(data.read_connection) == 24);
+	closure = wl_connection_demarshal(data.read_connection, 24,
+					  &objects, &nullable);
+	assert(closure);
+	assert(closure->args[0].u == 8000);
+	assert(closure->args[1].i == -557799);
+	assert(closure->args[2].f == wl_fixed_from_int(12));
+	assert(closure->args[3].n == 0);
+	wl_closure_destroy(closure);
+
+	/* Too short for all four arguments. */
+	msg[1] = 20 << 16;
+	assert(write(data.s[1], msg, 20) == 20);
+	assert(wl_connection_read(data.read_connection) == 20);
+	closure = wl_connection_demarshal(data.read_connection, 20,
+					  &objects, &nullable);
+	assert(closure == NULL);
+	assert(errno == EINVAL);
+
+	wl_map_release(&objects);
+	release_marshal_data(&data);
+}
+
+TEST(connection_demarshal_closure_pool)
+{
+	struct marshal_data data;
+	struct wl_closure_pool_stats stats;
+	uint32_t msg[10];
+	int i;
+
+	setup_marshal_data(&data);
+
+	for (i = 0; i < 10; i++) {
+		data.value.u = i;
+		msg[0] = 400200;
+		msg[1] = 12;
+		msg[2] = data.value.u;
+		demarshal(&data, "u", msg, (void *) validate_demarshal_u);
+	}
+
+	/* Only the first closure needs malloc, the rest are recycled. */
+	wl_connection_get_closure_pool_stats(data.read_connection, &stats);
+	assert(stats.misses == 1);
+	assert(stats.hits == 9);
+	assert(stats.in_use == 0);
+	assert(stats.high_water == 1);
+
+	release_marshal_data(&data);
+}
+
 static void
 marshal_demarshal(struct marshal_data *data, 
 		  void (*func)(void), int size, const char *format, ...)
@@ -511,6 +699,59 @@ TEST(connection_marshal_alot)
 	release_marshal_data(&data);
 }
 
+TEST(connection_marshal_many_fds)
+{
+	struct marshal_data data;
+	struct wl_connection_fd_stats stats;
+	struct wl_closure *closure;
+	static struct wl_object sender = { NULL, NULL, 1234 };
+	struct wl_message message = { "test", "h", NULL };
+	struct wl_map objects;
+	union wl_argument arg;
+	int p[2], i;
+
+	setup_marshal_data(&data);
+	assert(pipe(p) == 0);
+	arg.h = p[0];
+
+	/* Queue more fds than fit in one sendmsg(), one per message. */
+	for (i = 0; i < 40; i++) {
+		closure = wl_closure_marshal(&sender, 4444, &arg, &message);
+		assert(closure);
+		assert(wl_closure_send(closure, data.write_connection) == 0);
+		wl_closure_destroy(closure);
+	}
+
+	assert(wl_connection_flush(data.write_connection) == 40 * 8);
+	wl_connection_get_fd_stats(data.write_connection, &stats);
+	assert(stats.sent == 40);
+	assert(stats.sends == 2);
+	assert(stats.queue_flushes == 0);
+	assert(stats.queue_high_water == 40);
+
+	/* The first sendmsg() ends right before the message of the 29th
+	 * fd, so each read sees fds only with their messages. */
+	assert(wl_connection_read(data.read_connection) == 28 * 8);
+	assert(wl_connection_read(data.read_connection) == 40 * 8);
+	wl_connection_get_fd_stats(data.read_connection, &stats);
+	assert(stats.received == 40);
+
+	wl_map_init(&objects, WL_MAP_SERVER_SIDE);
+	for (i = 0; i < 40; i++) {
+		closure = wl_connection_demarshal(data.read_connection, 8,
+						  &objects, &message);
+		assert(closure);
+		assert(closure->args[0].h >= 0);
+		close(closure->args[0].h);
+		wl_closure_destroy(closure);
+	}
+	wl_map_release(&objects);
+
+	close(p[0]);
+	close(p[1]);
+	release_marshal_data(&data);
+}
+
 TEST(connection_marshal_too_big)
 {
 	struct marshal_data data;
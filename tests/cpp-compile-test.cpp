@@ -0,0 +1,6 @@
+/* Test that the public headers, including the generated protocol headers
+ * and their typed dispatchers, can be compiled by a C++ compiler. */
+#include "wayland-client.h"
+#include "wayland-server.h"
+
+int main() { return 0; }
@@ -0,0 +1,469 @@
+/*
+ * Copyright © 2026 The Wayland contributors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/* Runs a client and a server over a socketpair in the same process and
+ * checks that every argument type arrives intact through the typed
+ * dispatchers generated by wayland-scanner --dispatchers. */
+
+#include <assert.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "wayland-client.h"
+#include "wayland-server.h"
+#include "test-runner.h"
+
+struct server_state {
+	struct wl_display *display;
+	struct wl_client *client;
+	struct wl_resource *surface;
+	struct wl_resource *region;
+	struct wl_resource *seat;
+	struct wl_resource *data_device;
+	struct wl_resource *data_source;
+	struct wl_resource *attached_buffer;
+	struct wl_resource *input_region;
+	int attach_x, attach_y;
+	int attached;
+	int pool_size;
+	char pool_byte;
+};
+
+struct client_state {
+	struct wl_display *display;
+	struct wl_compositor *compositor;
+	struct wl_shm *shm;
+	struct wl_seat *seat;
+	struct wl_data_device_manager *manager;
+	struct wl_surface *surface;
+	struct wl_data_device *data_device;
+	struct wl_data_source *data_source;
+	struct wl_data_offer *offer;
+	struct wl_data_offer *selection;
+	struct wl_surface *enter_surface;
+	struct wl_data_offer *enter_offer;
+	wl_fixed_t enter_x, enter_y;
+	uint32_t enter_serial;
+	int entered;
+	int globals;
+	int send_fd;
+};
+
+static void
+surface_attach(struct wl_client *client, struct wl_resource *resource,
+	       struct wl_resource *buffer, int32_t x, int32_t y)
+{
+	struct server_state *s = wl_resource_get_user_data(resource);
+
+	s->attached_buffer = buffer;
+	s->attach_x = x;
+	s->attach_y = y;
+	s->attached = 1;
+}
+
+static void
+surface_set_input_region(struct wl_client *client,
+			 struct wl_resource *resource,
+			 struct wl_resource *region)
+{
+	struct server_state *s = wl_resource_get_user_data(resource);
+
+	s->input_region = region;
+}
+
+static const struct wl_surface_interface surface_impl = {
+	.attach = surface_attach,
+	.set_input_region = surface_set_input_region,
+};
+
+static void
+compositor_create_surface(struct wl_client *client,
+			  struct wl_resource *resource, uint32_t id)
+{
+	struct server_state *s = wl_resource_get_user_data(resource);
+
+	s->surface = wl_resource_create(client, &wl_surface_interface,
+					wl_resource_get_version(resource), id);
+	assert(s->surface);
+	wl_resource_set_dispatcher(s->surface, wl_surface_interface_dispatcher,
+				   &surface_impl, s, NULL);
+}
+
+static void
+compositor_create_region(struct wl_client *client,
+			 struct wl_resource *resource, uint32_t id)
+{
+	struct server_state *s = wl_resource_get_user_data(resource);
+
+	s->region = wl_resource_create(client, &wl_region_interface, 1, id);
+	assert(s->region);
+}
+
+static const struct wl_compositor_interface compositor_impl = {
+	compositor_create_surface,
+	compositor_create_region,
+};
+
+static void
+shm_create_pool(struct wl_client *client, struct wl_resource *resource,
+		uint32_t id, int32_t fd, int32_t size)
+{
+	struct server_state *s = wl_resource_get_user_data(resource);
+	struct wl_resource *pool;
+
+	assert(read(fd, &s->pool_byte, 1) == 1);
+	close(fd);
+	s->pool_size = size;
+
+	pool = wl_resource_create(client, &wl_shm_pool_interface, 1, id);
+	assert(pool);
+}
+
+static const struct wl_shm_interface shm_impl = {
+	shm_create_pool,
+};
+
+static void
+manager_create_data_source(struct wl_client *client,
+			   struct wl_resource *resource, uint32_t id)
+{
+	struct server_state *s = wl_resource_get_user_data(resource);
+
+	s->data_source = wl_resource_create(client, &wl_data_source_interface,
+					    1, id);
+	assert(s->data_source);
+}
+
+static void
+manager_get_data_device(struct wl_client *client,
+			struct wl_resource *resource, uint32_t id,
+			struct wl_resource *seat)
+{
+	struct server_state *s = wl_resource_get_user_data(resource);
+
+	assert(seat == s->seat);
+	s->data_device = wl_resource_create(client, &wl_data_device_interface,
+					    1, id);
+	assert(s->data_device);
+}
+
+static const struct wl_data_device_manager_interface manager_impl = {
+	manager_create_data_source,
+	manager_get_data_device,
+};
+
+static void
+bind_compositor(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &wl_compositor_interface,
+				      version, id);
+	assert(resource);
+	wl_resource_set_dispatcher(resource, wl_compositor_interface_dispatcher,
+				   &compositor_impl, data, NULL);
+}
+
+static void
+bind_shm(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &wl_shm_interface, version, id);
+	assert(resource);
+	wl_resource_set_dispatcher(resource, wl_shm_interface_dispatcher,
+				   &shm_impl, data, NULL);
+}
+
+static void
+bind_seat(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+	struct server_state *s = data;
+
+	s->seat = wl_resource_create(client, &wl_seat_interface, version, id);
+	assert(s->seat);
+}
+
+static void
+bind_manager(struct wl_client *client, void *data,
+	     uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &wl_data_device_manager_interface,
+				      version, id);
+	assert(resource);
+	wl_resource_set_dispatcher(resource,
+				   wl_data_device_manager_interface_dispatcher,
+				   &manager_impl, data, NULL);
+}
+
+static void
+registry_handle_global(void *data, struct wl_registry *registry,
+		       uint32_t name, const char *interface, uint32_t version)
+{
+	struct client_state *c = data;
+
+	/* wl_registry.bind is the untyped new_id ("sun") request, and the
+	 * server dispatches it through wl_registry_interface_dispatcher. */
+	if (strcmp(interface, "wl_compositor") == 0) {
+		assert(version == 3);
+		c->compositor = wl_registry_bind(registry, name,
+						 &wl_compositor_interface, 3);
+	} else if (strcmp(interface, "wl_shm") == 0) {
+		c->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, "wl_seat") == 0) {
+		c->seat = wl_registry_bind(registry, name, &wl_seat_interface, 1);
+	} else if (strcmp(interface, "wl_data_device_manager") == 0) {
+		c->manager = wl_registry_bind(registry, name,
+					      &wl_data_device_manager_interface,
+					      1);
+	}
+
+	c->globals++;
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_handle_global,
+	NULL
+};
+
+static void
+data_device_data_offer(void *data, struct wl_data_device *data_device,
+		       struct wl_data_offer *offer)
+{
+	struct client_state *c = data;
+
+	assert(data_device == c->data_device);
+	assert(offer);
+	assert(strcmp(wl_proxy_get_class((struct wl_proxy *) offer),
+		      "wl_data_offer") == 0);
+	c->offer = offer;
+}
+
+static void
+data_device_enter(void *data, struct wl_data_device *data_device,
+		  uint32_t serial, struct wl_surface *surface,
+		  wl_fixed_t x, wl_fixed_t y, struct wl_data_offer *offer)
+{
+	struct client_state *c = data;
+
+	c->enter_serial = serial;
+	c->enter_surface = surface;
+	c->enter_x = x;
+	c->enter_y = y;
+	c->enter_offer = offer;
+	c->entered = 1;
+}
+
+static void
+data_device_selection(void *data, struct wl_data_device *data_device,
+		      struct wl_data_offer *offer)
+{
+	struct client_state *c = data;
+
+	c->selection = offer;
+}
+
+static const struct wl_data_device_listener data_device_listener = {
+	data_device_data_offer,
+	data_device_enter,
+	NULL,
+	NULL,
+	NULL,
+	data_device_selection
+};
+
+static void
+data_source_send(void *data, struct wl_data_source *source,
+		 const char *mime_type, int32_t fd)
+{
+	struct client_state *c = data;
+
+	assert(strcmp(mime_type, "text/plain") == 0);
+	c->send_fd = fd;
+}
+
+static const struct wl_data_source_listener data_source_listener = {
+	NULL,
+	data_source_send,
+	NULL
+};
+
+static void
+sync_done(void *data, struct wl_callback *callback, uint32_t serial)
+{
+	int *done = data;
+
+	*done = 1;
+}
+
+static const struct wl_callback_listener sync_listener = {
+	sync_done
+};
+
+/* The client and the server share this thread, so let the server handle
+ * everything the client sent before blocking on the reply. */
+static void
+roundtrip(struct server_state *s, struct client_state *c)
+{
+	struct wl_event_loop *loop = wl_display_get_event_loop(s->display);
+	struct wl_callback *callback;
+	int done = 0;
+
+	callback = wl_display_sync(c->display);
+	wl_callback_add_typed_listener(callback, &sync_listener, &done);
+	assert(wl_display_flush(c->display) >= 0);
+
+	while (!done) {
+		assert(wl_event_loop_dispatch(loop, 0) >= 0);
+		wl_display_flush_clients(s->display);
+		assert(wl_display_dispatch(c->display) >= 0);
+	}
+
+	wl_callback_destroy(callback);
+}
+
+TEST(typed_dispatchers)
+{
+	struct server_state s;
+	struct client_state c;
+	struct wl_registry *registry;
+	struct wl_region *region;
+	struct wl_shm_pool *pool;
+	struct wl_resource *offer;
+	int sv[2], p[2];
+	char byte;
+
+	memset(&s, 0, sizeof s);
+	memset(&c, 0, sizeof c);
+	c.send_fd = -1;
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == 0);
+	s.display = wl_display_create();
+	assert(s.display);
+	s.client = wl_client_create(s.display, sv[0]);
+	assert(s.client);
+	c.display = wl_display_connect_to_fd(sv[1]);
+	assert(c.display);
+
+	assert(wl_global_create(s.display, &wl_compositor_interface, 3,
+				&s, bind_compositor));
+	assert(wl_global_create(s.display, &wl_shm_interface, 1,
+				&s, bind_shm));
+	assert(wl_global_create(s.display, &wl_seat_interface, 1,
+				&s, bind_seat));
+	assert(wl_global_create(s.display, &wl_data_device_manager_interface, 1,
+				&s, bind_manager));
+
+	/* Typed string and uint arguments on the client, untyped new_id
+	 * on the server. */
+	registry = wl_display_get_registry(c.display);
+	wl_registry_add_typed_listener(registry, &registry_listener, &c);
+	roundtrip(&s, &c);
+	assert(c.globals == 4);
+	assert(c.compositor && c.shm && c.seat && c.manager);
+
+	/* Typed new_id, nullable and non-null objects, and ints on the
+	 * server. */
+	c.surface = wl_compositor_create_surface(c.compositor);
+	region = wl_compositor_create_region(c.compositor);
+	roundtrip(&s, &c);
+	assert(s.surface && s.region);
+
+	s.input_region = NULL;
+	wl_surface_attach(c.surface, NULL, 12, -34);
+	wl_surface_set_input_region(c.surface, region);
+	roundtrip(&s, &c);
+	assert(s.attached);
+	assert(s.attached_buffer == NULL);
+	assert(s.attach_x == 12 && s.attach_y == -34);
+	assert(s.input_region == s.region);
+
+	/* An fd on the server. */
+	assert(pipe(p) == 0);
+	assert(write(p[1], "x", 1) == 1);
+	pool = wl_shm_create_pool(c.shm, p[0], 4096);
+	close(p[0]);
+	close(p[1]);
+	roundtrip(&s, &c);
+	assert(s.pool_size == 4096);
+	assert(s.pool_byte == 'x');
+
+	c.data_device = wl_data_device_manager_get_data_device(c.manager,
+							       c.seat);
+	wl_data_device_add_typed_listener(c.data_device,
+					  &data_device_listener, &c);
+	c.data_source = wl_data_device_manager_create_data_source(c.manager);
+	wl_data_source_add_typed_listener(c.data_source,
+					  &data_source_listener, &c);
+	roundtrip(&s, &c);
+	assert(s.data_device && s.data_source);
+
+	/* Typed new_id, nullable objects and fixed on the client. */
+	offer = wl_resource_create(s.client, &wl_data_offer_interface, 1, 0);
+	assert(offer);
+	wl_data_device_send_data_offer(s.data_device, offer);
+	wl_data_device_send_enter(s.data_device, 7, s.surface,
+				  wl_fixed_from_double(1.5),
+				  wl_fixed_from_int(-2), NULL);
+	wl_data_device_send_selection(s.data_device, offer);
+	roundtrip(&s, &c);
+	assert(c.offer);
+	assert(c.entered);
+	assert(c.enter_serial == 7);
+	assert(c.enter_surface == c.surface);
+	assert(c.enter_x == wl_fixed_from_double(1.5));
+	assert(c.enter_y == wl_fixed_from_int(-2));
+	assert(c.enter_offer == NULL);
+	assert(c.selection == c.offer);
+
+	/* A string and an fd on the client. */
+	assert(pipe(p) == 0);
+	wl_data_source_send_send(s.data_source, "text/plain", p[1]);
+	close(p[1]);
+	roundtrip(&s, &c);
+	assert(c.send_fd >= 0);
+	assert(write(c.send_fd, "y", 1) == 1);
+	close(c.send_fd);
+	assert(read(p[0], &byte, 1) == 1);
+	assert(byte == 'y');
+	close(p[0]);
+
+	wl_client_destroy(s.client);
+	wl_display_destroy(s.display);
+
+	wl_proxy_destroy((struct wl_proxy *) c.offer);
+	wl_proxy_destroy((struct wl_proxy *) c.data_source);
+	wl_proxy_destroy((struct wl_proxy *) c.data_device);
+	wl_proxy_destroy((struct wl_proxy *) pool);
+	wl_proxy_destroy((struct wl_proxy *) region);
+	wl_proxy_destroy((struct wl_proxy *) c.surface);
+	wl_data_device_manager_destroy(c.manager);
+	wl_seat_destroy(c.seat);
+	wl_shm_destroy(c.shm);
+	wl_compositor_destroy(c.compositor);
+	wl_registry_destroy(registry);
+	wl_display_disconnect(c.display);
+}
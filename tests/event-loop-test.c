@@ -22,10 +22,14 @@
  */
 
 #include <stdlib.h>
+#include <errno.h>
+#include <string.h>
 #include <assert.h>
 #include <unistd.h>
 #include <signal.h>
 #include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "wayland-private.h"
 #include "wayland-server.h"
@@ -173,6 +177,49 @@ TEST(event_loop_signal)
 	wl_event_loop_destroy(loop);
 }
 
+static int
+signal_check_callback(int signal_number, void *data)
+{
+	int *count = data;
+
+	assert(signal_number == SIGUSR1);
+	++(*count);
+
+	return 0;
+}
+
+TEST(event_loop_signal_check)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_source *s1, *s2;
+	int count = 0;
+
+	s1 = wl_event_loop_add_signal(loop, SIGUSR1,
+				      signal_check_callback, &count);
+	assert(s1);
+	s2 = wl_event_loop_add_signal(loop, SIGUSR1,
+				      signal_check_callback, &count);
+	assert(s2);
+
+	/* A checked signal source is called on every dispatch, and still
+	 * gets the signal along with the other source. */
+	wl_event_source_check(s1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count == 1);
+
+	assert(kill(getpid(), SIGUSR1) == 0);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count == 4);
+
+	wl_event_source_remove(s1);
+	assert(kill(getpid(), SIGUSR1) == 0);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count == 5);
+
+	wl_event_source_remove(s2);
+	wl_event_loop_destroy(loop);
+}
+
 TEST(event_loop_multiple_same_signals)
 {
 	struct wl_event_loop *loop = wl_event_loop_create();
@@ -212,6 +259,48 @@ TEST(event_loop_multiple_same_signals)
 	wl_event_loop_destroy(loop);
 }
 
+static int
+signal_any_callback(int signal_number, void *data)
+{
+	int *got = data;
+
+	got[signal_number == SIGUSR1 ? 0 : 1]++;
+
+	return 1;
+}
+
+TEST(event_loop_multiple_signals)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_source *s1, *s2;
+	int got[2] = { 0, 0 };
+
+	s1 = wl_event_loop_add_signal(loop, SIGUSR1,
+				      signal_any_callback, got);
+	assert(s1);
+	s2 = wl_event_loop_add_signal(loop, SIGUSR2,
+				      signal_any_callback, got);
+	assert(s2);
+
+	/* Both signals are pending on the shared signalfd and are
+	 * routed to their sources by a single dispatch. */
+	assert(kill(getpid(), SIGUSR1) == 0);
+	assert(kill(getpid(), SIGUSR2) == 0);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(got[0] == 1);
+	assert(got[1] == 1);
+
+	/* Removing one source leaves the other signal watched. */
+	wl_event_source_remove(s1);
+	assert(kill(getpid(), SIGUSR2) == 0);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(got[0] == 1);
+	assert(got[1] == 2);
+
+	wl_event_source_remove(s2);
+	wl_event_loop_destroy(loop);
+}
+
 static int
 timer_callback(void *data)
 {
@@ -248,6 +337,66 @@ TEST(event_loop_timer)
 	wl_event_loop_destroy(loop);
 }
 
+static int
+timer_check_callback(void *data)
+{
+	int *count = data;
+
+	++(*count);
+
+	return 0;
+}
+
+static int
+check_count_callback(int fd, uint32_t mask, void *data)
+{
+	int *count = data;
+
+	++(*count);
+
+	return 0;
+}
+
+TEST(event_loop_timer_check)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_source *timer, *other;
+	int timer_count = 0, other_count = 0, p[2];
+
+	assert(loop);
+	assert(pipe(p) == 0);
+
+	/* A timer that is also a check source keeps its place on the
+	 * check list when it expires. */
+	timer = wl_event_loop_add_timer(loop, timer_check_callback,
+					&timer_count);
+	assert(timer);
+	other = wl_event_loop_add_fd(loop, p[0], WL_EVENT_READABLE,
+				     check_count_callback, &other_count);
+	assert(other);
+	wl_event_source_check(timer);
+	wl_event_source_check(other);
+
+	assert(wl_event_source_timer_update(timer, 1) == 0);
+	assert(wl_event_loop_dispatch(loop, 50) == 0);
+	assert(timer_count == 2);
+	assert(other_count == 1);
+
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(timer_count == 3);
+	assert(other_count == 2);
+
+	wl_event_source_remove(timer);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(timer_count == 3);
+	assert(other_count == 3);
+
+	wl_event_source_remove(other);
+	close(p[0]);
+	close(p[1]);
+	wl_event_loop_destroy(loop);
+}
+
 #define MSEC_TO_USEC(msec) ((msec) * 1000)
 
 struct timer_update_context {
@@ -388,3 +537,1011 @@ TEST(event_loop_destroy)
 	assert(a.done);
 }
 
+
+static int
+count_dispatch(int fd, uint32_t mask, void *data)
+{
+	int *p = data;
+
+	++(*p);
+
+	return 0;
+}
+
+TEST(event_loop_batch_size)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_source *sources[40];
+	struct wl_event_loop_stats stats;
+	int p[40][2], i, count = 0;
+
+	assert(loop);
+
+	for (i = 0; i < 40; i++) {
+		assert(pipe(p[i]) == 0);
+		assert(write(p[i][1], "x", 1) == 1);
+		sources[i] = wl_event_loop_add_fd(loop, p[i][0],
+						  WL_EVENT_READABLE,
+						  count_dispatch, &count);
+		assert(sources[i]);
+	}
+
+	/* The batch grows with the number of sources, so all of them
+	 * are picked up by a single wakeup. */
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count == 40);
+	wl_event_loop_get_stats(loop, &stats);
+	assert(stats.wakeups == 1);
+	assert(stats.events == 40);
+	assert(stats.max_events_per_wakeup == 40);
+	assert(stats.batch_size == 40);
+	assert(stats.full_batches == 1);
+
+	wl_event_loop_set_max_events(loop, 8);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count == 48);
+	wl_event_loop_get_stats(loop, &stats);
+	assert(stats.wakeups == 2);
+	assert(stats.events == 48);
+	assert(stats.batch_size == 8);
+	assert(stats.full_batches == 2);
+
+	for (i = 0; i < 40; i++) {
+		wl_event_source_remove(sources[i]);
+		assert(close(p[i][0]) == 0);
+		assert(close(p[i][1]) == 0);
+	}
+	wl_event_loop_destroy(loop);
+}
+
+struct timer_order_context {
+	int order[4];
+	int count;
+};
+
+struct timer_order_timer {
+	struct timer_order_context *context;
+	struct wl_event_source *source;
+	int id;
+};
+
+static int
+timer_order_callback(void *data)
+{
+	struct timer_order_timer *timer = data;
+	struct timer_order_context *context = timer->context;
+
+	context->order[context->count++] = timer->id;
+
+	return 1;
+}
+
+TEST(event_loop_timer_order)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct timer_order_context context;
+	struct timer_order_timer timers[4];
+	static const int delays[4] = { 30, 10, 20, 5 };
+	int i;
+
+	assert(loop);
+	context.count = 0;
+
+	for (i = 0; i < 4; i++) {
+		timers[i].context = &context;
+		timers[i].id = i;
+		timers[i].source = wl_event_loop_add_timer(loop,
+							   timer_order_callback,
+							   &timers[i]);
+		assert(timers[i].source);
+		assert(wl_event_source_timer_update(timers[i].source,
+						    delays[i]) == 0);
+	}
+
+	/* Disarming and removing take timers out of the queue. */
+	assert(wl_event_source_timer_update(timers[3].source, 0) == 0);
+	wl_event_source_remove(timers[2].source);
+
+	while (context.count < 2)
+		assert(wl_event_loop_dispatch(loop, 100) == 0);
+	assert(wl_event_loop_dispatch(loop, 50) == 0);
+
+	assert(context.count == 2);
+	assert(context.order[0] == 1);
+	assert(context.order[1] == 0);
+
+	wl_event_source_remove(timers[0].source);
+	wl_event_source_remove(timers[1].source);
+	wl_event_source_remove(timers[3].source);
+	wl_event_loop_destroy(loop);
+}
+
+struct timer_deadline_context {
+	int calls;
+	uint64_t expirations;
+};
+
+static int
+timer_deadline_callback(uint64_t expirations, void *data)
+{
+	struct timer_deadline_context *context = data;
+
+	context->calls++;
+	context->expirations += expirations;
+
+	return 1;
+}
+
+static void
+timespec_add_ns(struct timespec *ts, uint64_t ns)
+{
+	uint64_t total = (uint64_t) ts->tv_nsec + ns;
+
+	ts->tv_sec += total / 1000000000;
+	ts->tv_nsec = total % 1000000000;
+}
+
+TEST(event_loop_timer_deadline)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct timer_deadline_context oneshot = { 0, 0 };
+	struct timer_deadline_context periodic = { 0, 0 };
+	struct wl_event_source *source_oneshot;
+	struct wl_event_source *source_periodic;
+	struct timespec now, deadline;
+
+	assert(loop);
+
+	source_oneshot = wl_event_loop_add_timer_deadline(loop,
+							  timer_deadline_callback,
+							  &oneshot);
+	source_periodic = wl_event_loop_add_timer_deadline(loop,
+							   timer_deadline_callback,
+							   &periodic);
+	assert(source_oneshot && source_periodic);
+
+	/* An absolute deadline with slack never fires early. */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	deadline = now;
+	timespec_add_ns(&deadline, 20000000);
+	assert(wl_event_source_timer_set_deadline(source_oneshot, &deadline,
+						  5000000) == 0);
+
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(oneshot.calls == 0);
+
+	while (oneshot.calls == 0)
+		assert(wl_event_loop_dispatch(loop, 100) == 0);
+	assert(oneshot.expirations == 1);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	assert(now.tv_sec > deadline.tv_sec ||
+	       (now.tv_sec == deadline.tv_sec &&
+		now.tv_nsec >= deadline.tv_nsec));
+
+	/* A periodic timer that isn't serviced in time reports every
+	 * period it missed in a single callback. */
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	timespec_add_ns(&deadline, 1000000);
+	assert(wl_event_source_timer_set_interval(source_periodic,
+						  1000000) == 0);
+	assert(wl_event_source_timer_set_deadline(source_periodic, &deadline,
+						  0) == 0);
+	usleep(10000);
+
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(periodic.calls == 1);
+	assert(periodic.expirations >= 5);
+
+	/* NULL disarms the timer. */
+	assert(wl_event_source_timer_set_deadline(source_periodic, NULL,
+						  0) == 0);
+	usleep(5000);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(periodic.calls == 1);
+
+	wl_event_source_remove(source_oneshot);
+	wl_event_source_remove(source_periodic);
+	wl_event_loop_destroy(loop);
+}
+
+TEST(event_loop_timer_huge_slack)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct timer_deadline_context lazy = { 0, 0 };
+	struct timer_deadline_context strict = { 0, 0 };
+	struct wl_event_source *source_lazy, *source_strict;
+	struct timespec deadline;
+
+	assert(loop);
+
+	source_lazy = wl_event_loop_add_timer_deadline(loop,
+						       timer_deadline_callback,
+						       &lazy);
+	source_strict = wl_event_loop_add_timer_deadline(loop,
+							 timer_deadline_callback,
+							 &strict);
+	assert(source_lazy && source_strict);
+
+	/* deadline + slack would wrap to 5ms from now if it weren't
+	 * saturated. */
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	timespec_add_ns(&deadline, 20000000);
+	assert(wl_event_source_timer_set_deadline(source_lazy, &deadline,
+						  UINT64_MAX - 15000000) == 0);
+	usleep(10000);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(lazy.calls == 0);
+
+	/* Once its deadline has passed, it runs along with another timer
+	 * that is due. */
+	timespec_add_ns(&deadline, 10000000);
+	assert(wl_event_source_timer_set_deadline(source_strict, &deadline,
+						  0) == 0);
+	while (strict.calls == 0)
+		assert(wl_event_loop_dispatch(loop, 100) == 0);
+	assert(lazy.calls == 1);
+
+	wl_event_source_remove(source_lazy);
+	wl_event_source_remove(source_strict);
+	wl_event_loop_destroy(loop);
+}
+
+static int
+fd_count_dispatch(int fd, uint32_t mask, void *data)
+{
+	int *p = data;
+
+	assert(mask & WL_EVENT_READABLE);
+	++(*p);
+
+	return 1;
+}
+
+TEST(event_loop_fd_edge_triggered)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_source *source;
+	struct wl_event_loop_stats stats;
+	int p[2], count = 0;
+	char c = 'x';
+
+	assert(loop);
+	assert(pipe(p) == 0);
+
+	source = wl_event_loop_add_fd(loop, p[0],
+				      WL_EVENT_READABLE |
+				      WL_EVENT_EDGE_TRIGGERED,
+				      fd_count_dispatch, &count);
+	assert(source);
+
+	/* Unread data is only reported once... */
+	assert(write(p[1], &c, 1) == 1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count == 1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count == 1);
+
+	/* ...until more arrives. */
+	assert(write(p[1], &c, 1) == 1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count == 2);
+
+	/* Updates that don't change the mask never reach the kernel, and
+	 * the source stays edge-triggered across real updates. */
+	assert(wl_event_source_fd_update(source, WL_EVENT_READABLE) == 0);
+	wl_event_loop_get_stats(loop, &stats);
+	assert(stats.fd_updates == 0);
+	assert(stats.fd_updates_skipped == 1);
+
+	assert(wl_event_source_fd_update(source, 0) == 0);
+	assert(wl_event_source_fd_update(source, WL_EVENT_READABLE) == 0);
+	wl_event_loop_get_stats(loop, &stats);
+	assert(stats.fd_updates == 2);
+	assert(stats.fd_updates_skipped == 1);
+
+	/* Re-arming reports the data still in the pipe once. */
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(count == 3);
+
+	wl_event_source_remove(source);
+	wl_event_loop_destroy(loop);
+	close(p[0]);
+	close(p[1]);
+}
+
+static int
+timer_count_callback(void *data)
+{
+	int *got_it = data;
+
+	++(*got_it);
+
+	return 1;
+}
+
+extern char **environ;
+
+TEST(event_loop_io_uring)
+{
+	struct wl_event_loop *loop;
+	struct wl_event_source *level, *edge, *timer;
+	int level_pipe[2], edge_pipe[2];
+	int level_count = 0, edge_count = 0, timer_count = 0;
+	char *uring_environ[] = { "WAYLAND_EVENT_LOOP=io_uring", NULL };
+	char **saved_environ;
+	char c = 'x';
+
+	/* setenv() allocates memory the leak checker would flag, so swap
+	 * in a static environment instead. */
+	saved_environ = environ;
+	environ = uring_environ;
+	loop = wl_event_loop_create();
+	environ = saved_environ;
+	assert(loop);
+
+	/* Kernels without io_uring fall back to epoll. */
+	if (strcmp(wl_event_loop_get_backend(loop), "io_uring") != 0) {
+		assert(strcmp(wl_event_loop_get_backend(loop), "epoll") == 0);
+		wl_event_loop_destroy(loop);
+		return;
+	}
+
+	assert(pipe(level_pipe) == 0);
+	assert(pipe(edge_pipe) == 0);
+	level = wl_event_loop_add_fd(loop, level_pipe[0], WL_EVENT_READABLE,
+				     fd_count_dispatch, &level_count);
+	edge = wl_event_loop_add_fd(loop, edge_pipe[0],
+				    WL_EVENT_READABLE |
+				    WL_EVENT_EDGE_TRIGGERED,
+				    fd_count_dispatch, &edge_count);
+	timer = wl_event_loop_add_timer(loop, timer_count_callback,
+					&timer_count);
+	assert(level && edge && timer);
+
+	assert(write(level_pipe[1], &c, 1) == 1);
+	assert(write(edge_pipe[1], &c, 1) == 1);
+	assert(wl_event_loop_dispatch(loop, 100) == 0);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+
+	/* Unread data keeps a level-triggered source ready, while the
+	 * edge-triggered one is only reported once. */
+	assert(level_count == 2);
+	assert(edge_count == 1);
+
+	assert(read(level_pipe[0], &c, 1) == 1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(level_count == 2);
+	assert(edge_count == 1);
+
+	/* Removed sources don't get completions that were still queued. */
+	assert(write(level_pipe[1], &c, 1) == 1);
+	wl_event_source_remove(level);
+
+	assert(wl_event_source_timer_update(timer, 10) == 0);
+	while (timer_count == 0)
+		assert(wl_event_loop_dispatch(loop, 100) == 0);
+	assert(level_count == 2);
+
+	wl_event_source_remove(edge);
+	wl_event_source_remove(timer);
+	wl_event_loop_destroy(loop);
+	close(level_pipe[0]);
+	close(level_pipe[1]);
+	close(edge_pipe[0]);
+	close(edge_pipe[1]);
+}
+
+extern int leak_check_enabled;
+
+struct post_context {
+	struct wl_event_loop *loop;
+	int order[4];
+	int count;
+};
+
+struct post_task {
+	struct post_context *context;
+	int id;
+};
+
+static void
+post_callback(void *data)
+{
+	struct post_task *task = data;
+
+	task->context->order[task->context->count++] = task->id;
+}
+
+static void *
+post_thread(void *data)
+{
+	struct post_task *task = data;
+
+	assert(wl_event_loop_post(task->context->loop,
+				  post_callback, task) == 0);
+
+	return NULL;
+}
+
+TEST(event_loop_post)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_loop_stats stats;
+	struct post_context context;
+	struct post_task tasks[4];
+	int i;
+
+	assert(loop);
+	context.loop = loop;
+	context.count = 0;
+	for (i = 0; i < 4; i++) {
+		tasks[i].context = &context;
+		tasks[i].id = i;
+	}
+
+	/* Posts that pile up run in order off a single wakeup. */
+	for (i = 0; i < 4; i++)
+		assert(wl_event_loop_post(loop, post_callback, &tasks[i]) == 0);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+
+	assert(context.count == 4);
+	for (i = 0; i < 4; i++)
+		assert(context.order[i] == i);
+
+	wl_event_loop_get_stats(loop, &stats);
+	assert(stats.posted_tasks == 4);
+	assert(stats.post_wakeups == 1);
+
+	/* Tasks left over when the loop goes away are dropped. */
+	assert(wl_event_loop_post(loop, post_callback, &tasks[0]) == 0);
+	wl_event_loop_destroy(loop);
+	assert(context.count == 4);
+}
+
+TEST(event_loop_post_from_thread)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct post_context context;
+	struct post_task task;
+	pthread_t thread;
+
+	/* glibc keeps an allocation around for the thread's stack cache,
+	 * which the leak checker would count against us. */
+	leak_check_enabled = 0;
+
+	assert(loop);
+	context.loop = loop;
+	context.count = 0;
+	task.context = &context;
+	task.id = 0;
+
+	/* A post from another thread wakes a loop that's blocked. */
+	assert(pthread_create(&thread, NULL, post_thread, &task) == 0);
+	while (context.count == 0)
+		assert(wl_event_loop_dispatch(loop, -1) == 0);
+	assert(pthread_join(thread, NULL) == 0);
+
+	assert(context.order[0] == 0);
+
+	wl_event_loop_destroy(loop);
+}
+
+struct idle_rearm_context {
+	struct wl_event_source *source;
+	int count;
+	int rearm;
+};
+
+static void
+idle_rearm_callback(void *data)
+{
+	struct idle_rearm_context *context = data;
+
+	context->count++;
+	if (context->rearm)
+		assert(wl_event_source_idle_update(context->source, 1) == 0);
+}
+
+static void
+idle_nop_callback(void *data)
+{
+}
+
+TEST(event_loop_idle_persistent)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct idle_rearm_context context = { NULL, 0, 0 };
+	struct wl_event_source *oneshot, *recycled, *timer;
+	int timer_count = 0;
+
+	assert(loop);
+
+	context.source = wl_event_loop_create_idle(loop, idle_rearm_callback,
+						   &context);
+	assert(context.source);
+
+	/* Created disarmed. */
+	wl_event_loop_dispatch_idle(loop);
+	assert(context.count == 0);
+
+	/* Arming twice still runs it once, and it stays around. */
+	assert(wl_event_source_idle_update(context.source, 1) == 0);
+	assert(wl_event_source_idle_update(context.source, 1) == 0);
+	wl_event_loop_dispatch_idle(loop);
+	assert(context.count == 1);
+	wl_event_loop_dispatch_idle(loop);
+	assert(context.count == 1);
+
+	/* Re-arming from the callback runs it again next time. */
+	context.rearm = 1;
+	assert(wl_event_source_idle_update(context.source, 1) == 0);
+	wl_event_loop_dispatch_idle(loop);
+	assert(context.count == 2);
+	wl_event_loop_dispatch_idle(loop);
+	assert(context.count == 3);
+
+	context.rearm = 0;
+	assert(wl_event_source_idle_update(context.source, 0) == 0);
+	wl_event_loop_dispatch_idle(loop);
+	assert(context.count == 3);
+
+	/* One-shot sources can't be re-armed, and their memory is reused
+	 * once they've run. */
+	oneshot = wl_event_loop_add_idle(loop, idle_nop_callback, NULL);
+	assert(oneshot);
+	assert(wl_event_source_idle_update(oneshot, 1) == -1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	recycled = wl_event_loop_add_idle(loop, idle_nop_callback, NULL);
+	assert(recycled == oneshot);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+
+	/* Neither other kinds of sources nor removed ones can be armed. */
+	timer = wl_event_loop_add_timer(loop, timer_callback, &timer_count);
+	assert(timer);
+	assert(wl_event_source_idle_update(timer, 1) == -1);
+	assert(errno == EINVAL);
+	wl_event_source_remove(timer);
+	wl_event_source_remove(context.source);
+	assert(wl_event_source_idle_update(context.source, 1) == -1);
+	assert(errno == EINVAL);
+	wl_event_loop_dispatch_idle(loop);
+	assert(context.count == 3);
+
+	wl_event_loop_destroy(loop);
+}
+
+static int
+slow_fd_dispatch(int fd, uint32_t mask, void *data)
+{
+	char c;
+
+	assert(read(fd, &c, 1) == 1);
+	usleep(20000);
+
+	return 1;
+}
+
+TEST(event_loop_profiling)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_source_profile source_profile;
+	struct wl_event_loop_profile loop_profile;
+	struct wl_event_source *fast, *slow, *idle;
+	int fast_pipe[2], slow_pipe[2], count = 0, i;
+	uint32_t total;
+	char c;
+
+	assert(loop);
+	assert(pipe(fast_pipe) == 0);
+	assert(pipe(slow_pipe) == 0);
+	fast = wl_event_loop_add_fd(loop, fast_pipe[0], WL_EVENT_READABLE,
+				    fd_count_dispatch, &count);
+	slow = wl_event_loop_add_fd(loop, slow_pipe[0], WL_EVENT_READABLE,
+				    slow_fd_dispatch, NULL);
+	idle = wl_event_loop_create_idle(loop, idle_nop_callback, NULL);
+	assert(fast && slow && idle);
+
+	/* Nothing is recorded until profiling is turned on. */
+	assert(write(fast_pipe[1], "x", 1) == 1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(read(fast_pipe[0], &c, 1) == 1);
+	wl_event_source_get_profile(fast, &source_profile);
+	assert(source_profile.dispatches == 0);
+
+	wl_event_loop_set_profiling(loop, 1);
+	assert(write(fast_pipe[1], "x", 1) == 1);
+	assert(write(slow_pipe[1], "x", 1) == 1);
+	assert(wl_event_source_idle_update(idle, 1) == 0);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+
+	wl_event_source_get_profile(slow, &source_profile);
+	assert(source_profile.dispatches == 1);
+	assert(source_profile.max_ns >= 20000000);
+	assert(source_profile.total_ns == source_profile.max_ns);
+	/* 20ms lands in the last bucket. */
+	assert(source_profile.histogram[WL_EVENT_SOURCE_PROFILE_BUCKETS - 1] == 1);
+
+	wl_event_source_get_profile(fast, &source_profile);
+	assert(source_profile.dispatches == 1);
+	for (i = 0, total = 0; i < WL_EVENT_SOURCE_PROFILE_BUCKETS; i++)
+		total += source_profile.histogram[i];
+	assert(total == 1);
+
+	wl_event_source_get_profile(idle, &source_profile);
+	assert(source_profile.dispatches == 1);
+
+	wl_event_loop_get_profile(loop, &loop_profile);
+	assert(loop_profile.latency_samples == 2);
+	assert(loop_profile.dispatch_ns >= 20000000);
+	assert(loop_profile.latency_max_ns <= loop_profile.latency_total_ns);
+
+	wl_event_source_remove(fast);
+	wl_event_source_remove(slow);
+	wl_event_source_remove(idle);
+	wl_event_loop_destroy(loop);
+	close(fast_pipe[0]);
+	close(fast_pipe[1]);
+	close(slow_pipe[0]);
+	close(slow_pipe[1]);
+}
+
+struct priority_context {
+	int order[4];
+	int count;
+};
+
+struct priority_source {
+	struct priority_context *context;
+	int id;
+	int drain;
+	int delay_us;
+};
+
+static int
+priority_dispatch(int fd, uint32_t mask, void *data)
+{
+	struct priority_source *source = data;
+	char c;
+
+	if (source->drain)
+		assert(read(fd, &c, 1) == 1);
+	if (source->delay_us)
+		usleep(source->delay_us);
+	if (source->context->count < 4)
+		source->context->order[source->context->count] = source->id;
+	source->context->count++;
+
+	return 1;
+}
+
+TEST(event_loop_priority)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	static const enum wl_event_source_priority priorities[3] = {
+		WL_EVENT_SOURCE_PRIORITY_BULK,
+		WL_EVENT_SOURCE_PRIORITY_DEFAULT,
+		WL_EVENT_SOURCE_PRIORITY_INPUT,
+	};
+	struct wl_event_source *sources[3];
+	struct priority_source data[3];
+	struct priority_context context = { { 0 }, 0 };
+	struct wl_event_loop_stats stats;
+	int p[3][2], i;
+
+	assert(loop);
+
+	for (i = 0; i < 3; i++) {
+		assert(pipe(p[i]) == 0);
+		assert(write(p[i][1], "x", 1) == 1);
+		data[i].context = &context;
+		data[i].id = i;
+		data[i].drain = 1;
+		data[i].delay_us = 0;
+		sources[i] = wl_event_loop_add_fd(loop, p[i][0],
+						  WL_EVENT_READABLE,
+						  priority_dispatch, &data[i]);
+		assert(sources[i]);
+		assert(wl_event_source_set_priority(sources[i],
+						    priorities[i]) == 0);
+	}
+	assert(wl_event_source_set_priority(sources[0],
+					    WL_EVENT_SOURCE_PRIORITY_COUNT) < 0);
+
+	/* Highest priority first, whatever order the kernel used. */
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(context.count == 3);
+	assert(context.order[0] == 2);
+	assert(context.order[1] == 1);
+	assert(context.order[2] == 0);
+
+	/* A slow callback uses up the budget, so the bulk source, which
+	 * hasn't consumed its data, is left for the next wakeup. */
+	context.count = 0;
+	data[0].drain = 0;
+	data[1].delay_us = 5000;
+	wl_event_loop_set_preempt_budget(loop, 1000);
+	assert(write(p[0][1], "x", 1) == 1);
+	assert(write(p[1][1], "x", 1) == 1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(context.count == 1);
+	assert(context.order[0] == 1);
+	wl_event_loop_get_stats(loop, &stats);
+	assert(stats.preempted_events == 1);
+
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(context.count == 2);
+	assert(context.order[1] == 0);
+
+	for (i = 0; i < 3; i++) {
+		wl_event_source_remove(sources[i]);
+		close(p[i][0]);
+		close(p[i][1]);
+	}
+	wl_event_loop_destroy(loop);
+}
+
+TEST(event_loop_preempt_timer)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_source *fd_source, *timer;
+	struct priority_source data;
+	struct priority_context context = { { 0 }, 0 };
+	struct wl_event_loop_stats stats;
+	int p[2], fired = 0;
+
+	assert(loop);
+
+	assert(pipe(p) == 0);
+	data.context = &context;
+	data.id = 0;
+	data.drain = 1;
+	data.delay_us = 5000;
+	fd_source = wl_event_loop_add_fd(loop, p[0], WL_EVENT_READABLE,
+					 priority_dispatch, &data);
+	assert(fd_source);
+	assert(wl_event_source_set_priority(fd_source,
+					    WL_EVENT_SOURCE_PRIORITY_INPUT) == 0);
+
+	timer = wl_event_loop_add_timer(loop, timer_callback, &fired);
+	assert(timer);
+	assert(wl_event_source_set_priority(timer,
+					    WL_EVENT_SOURCE_PRIORITY_BULK) == 0);
+
+	/* The slow input callback uses up the budget, but a timer isn't
+	 * reported again once skipped, so it must still run. */
+	wl_event_loop_set_preempt_budget(loop, 1000);
+	assert(wl_event_source_timer_update(timer, 1) == 0);
+	assert(write(p[1], "x", 1) == 1);
+	usleep(5000);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(context.count == 1);
+	assert(fired == 1);
+	wl_event_loop_get_stats(loop, &stats);
+	assert(stats.preempted_events == 0);
+
+	wl_event_source_remove(timer);
+	wl_event_source_remove(fd_source);
+	close(p[0]);
+	close(p[1]);
+	wl_event_loop_destroy(loop);
+}
+
+static int
+priority_signal(int signal_number, void *data)
+{
+	struct priority_source *source = data;
+
+	if (source->context->count < 4)
+		source->context->order[source->context->count] = source->id;
+	source->context->count++;
+
+	return 1;
+}
+
+TEST(event_loop_signal_priority)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_source *fd_source, *signal_source, *other;
+	struct priority_source data[2];
+	struct priority_context context = { { 0 }, 0 };
+	int p[2];
+
+	assert(loop);
+
+	assert(pipe(p) == 0);
+	assert(write(p[1], "x", 1) == 1);
+	data[0].context = &context;
+	data[0].id = 0;
+	data[0].drain = 1;
+	data[0].delay_us = 0;
+	fd_source = wl_event_loop_add_fd(loop, p[0], WL_EVENT_READABLE,
+					 priority_dispatch, &data[0]);
+	assert(fd_source);
+	assert(wl_event_source_set_priority(fd_source,
+					    WL_EVENT_SOURCE_PRIORITY_DISPLAY) == 0);
+
+	/* Signal sources share one signalfd, which takes the highest
+	 * priority of the sources on it. */
+	data[1] = data[0];
+	data[1].id = 1;
+	signal_source = wl_event_loop_add_signal(loop, SIGUSR1,
+						 priority_signal, &data[1]);
+	assert(signal_source);
+	other = wl_event_loop_add_signal(loop, SIGUSR2,
+					 priority_signal, &data[1]);
+	assert(other);
+	assert(wl_event_source_set_priority(signal_source,
+					    WL_EVENT_SOURCE_PRIORITY_INPUT) == 0);
+	assert(wl_event_source_set_priority(other,
+					    WL_EVENT_SOURCE_PRIORITY_BULK) == 0);
+
+	kill(getpid(), SIGUSR1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(context.count == 2);
+	assert(context.order[0] == 1);
+	assert(context.order[1] == 0);
+
+	/* Once the input source is gone, the signalfd drops to bulk. */
+	wl_event_source_remove(signal_source);
+	context.count = 0;
+	assert(write(p[1], "x", 1) == 1);
+	kill(getpid(), SIGUSR2);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(context.count == 2);
+	assert(context.order[0] == 0);
+	assert(context.order[1] == 1);
+
+	wl_event_source_remove(other);
+	wl_event_source_remove(fd_source);
+	close(p[0]);
+	close(p[1]);
+	wl_event_loop_destroy(loop);
+}
+
+static void
+idle_remove_self(void *data)
+{
+	struct wl_event_source **source = data;
+
+	wl_event_source_remove(*source);
+	*source = NULL;
+}
+
+TEST(event_loop_idle_remove_self)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	static const enum wl_event_source_priority priorities[2] = {
+		WL_EVENT_SOURCE_PRIORITY_BULK,
+		WL_EVENT_SOURCE_PRIORITY_INPUT,
+	};
+	struct wl_event_source *sources[2], *persistent, *oneshot;
+	struct priority_source data[2];
+	struct priority_context context = { { 0 }, 0 };
+	int p[2][2], i;
+
+	assert(loop);
+
+	for (i = 0; i < 2; i++) {
+		assert(pipe(p[i]) == 0);
+		data[i].context = &context;
+		data[i].id = i;
+		data[i].drain = 1;
+		data[i].delay_us = 0;
+		sources[i] = wl_event_loop_add_fd(loop, p[i][0],
+						  WL_EVENT_READABLE,
+						  priority_dispatch, &data[i]);
+		assert(sources[i]);
+		assert(wl_event_source_set_priority(sources[i],
+						    priorities[i]) == 0);
+	}
+
+	/* Idle sources with a priority that remove themselves from their
+	 * callback must only be removed once. */
+	persistent = wl_event_loop_create_idle(loop, idle_remove_self,
+					       &persistent);
+	assert(persistent);
+	assert(wl_event_source_set_priority(persistent,
+					    WL_EVENT_SOURCE_PRIORITY_DISPLAY) == 0);
+	assert(wl_event_source_idle_update(persistent, 1) == 0);
+	oneshot = wl_event_loop_add_idle(loop, idle_remove_self, &oneshot);
+	assert(oneshot);
+	assert(wl_event_source_set_priority(oneshot,
+					    WL_EVENT_SOURCE_PRIORITY_DISPLAY) == 0);
+	wl_event_loop_dispatch_idle(loop);
+	assert(persistent == NULL);
+	assert(oneshot == NULL);
+
+	/* Priority dispatch still works for the remaining sources. */
+	for (i = 0; i < 2; i++)
+		assert(write(p[i][1], "x", 1) == 1);
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(context.count == 2);
+	assert(context.order[0] == 1);
+	assert(context.order[1] == 0);
+
+	for (i = 0; i < 2; i++) {
+		wl_event_source_remove(sources[i]);
+		close(p[i][0]);
+		close(p[i][1]);
+	}
+	wl_event_loop_destroy(loop);
+}
+
+struct check_source {
+	struct wl_event_source *source;
+	int calls;
+	int work;
+	int p[2];
+};
+
+static int
+check_dispatch(int fd, uint32_t mask, void *data)
+{
+	struct check_source *check = data;
+
+	check->calls++;
+	if (check->work > 0) {
+		check->work--;
+		return 1;
+	}
+
+	return 0;
+}
+
+TEST(event_loop_check_passes)
+{
+	struct wl_event_loop *loop = wl_event_loop_create();
+	struct wl_event_loop_stats stats;
+	struct check_source checks[2];
+	int i;
+
+	assert(loop);
+
+	for (i = 0; i < 2; i++) {
+		assert(pipe(checks[i].p) == 0);
+		checks[i].calls = 0;
+		checks[i].work = 0;
+		checks[i].source = wl_event_loop_add_fd(loop, checks[i].p[0],
+							WL_EVENT_READABLE,
+							check_dispatch,
+							&checks[i]);
+		assert(checks[i].source);
+		wl_event_source_check(checks[i].source);
+	}
+
+	/* Only the source that keeps reporting work is called again. */
+	checks[0].work = 3;
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(checks[0].calls == 4);
+	assert(checks[1].calls == 1);
+	wl_event_loop_get_stats(loop, &stats);
+	assert(stats.check_passes == 4);
+	assert(stats.max_check_passes == 4);
+	assert(stats.capped_checks == 0);
+
+	/* With a limit the rest carries over to the next dispatch, which
+	 * doesn't block even though nothing else is ready. */
+	wl_event_loop_set_max_check_passes(loop, 2);
+	checks[0].work = 3;
+	assert(wl_event_loop_dispatch(loop, 0) == 0);
+	assert(checks[0].calls == 6);
+	assert(checks[1].calls == 2);
+	wl_event_loop_get_stats(loop, &stats);
+	assert(stats.capped_checks == 1);
+
+	assert(wl_event_loop_dispatch(loop, -1) == 0);
+	assert(checks[0].calls == 8);
+	assert(checks[1].calls == 3);
+	wl_event_loop_get_stats(loop, &stats);
+	assert(stats.capped_checks == 1);
+	assert(stats.check_passes == 4 + 2 + 2);
+
+	for (i = 0; i < 2; i++) {
+		wl_event_source_remove(checks[i].source);
+		close(checks[i].p[0]);
+		close(checks[i].p[1]);
+	}
+	wl_event_loop_destroy(loop);
+}
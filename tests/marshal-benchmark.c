@@ -0,0 +1,120 @@
+/*
+ * Copyright © 2026 The Wayland contributors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "wayland-private.h"
+#include "wayland-os.h"
+
+#define ITERATIONS	2000
+#define BATCH		128
+
+/* Round trip batches of a message through a connection pair: send,
+ * flush, read, demarshal.  The socket calls are the same for both
+ * marshalling paths, so the difference between runs is the cost of
+ * (de)serialization. */
+static void
+round_trip(const struct wl_message *message, union wl_argument *args)
+{
+	struct wl_connection *write_connection, *read_connection;
+	struct wl_closure *closure;
+	struct wl_object sender = { NULL, NULL, 1234 };
+	struct wl_message_desc desc_storage;
+	struct wl_map objects;
+	int s[2], i, j, size;
+
+	assert(wl_os_socketpair_cloexec(AF_UNIX, SOCK_STREAM, 0, s) == 0);
+	write_connection = wl_connection_create(s[0]);
+	read_connection = wl_connection_create(s[1]);
+	assert(write_connection && read_connection);
+	wl_map_init(&objects, WL_MAP_SERVER_SIDE);
+
+	closure = wl_closure_marshal(&sender, 0, args, message);
+	assert(closure);
+	size = wl_message_get_desc(message, &desc_storage)->fixed_size;
+
+	for (i = 0; i < ITERATIONS; i++) {
+		for (j = 0; j < BATCH; j++)
+			assert(wl_closure_send(closure, write_connection) == 0);
+		assert(wl_connection_flush(write_connection) == BATCH * size);
+		assert(wl_connection_read(read_connection) == BATCH * size);
+
+		for (j = 0; j < BATCH; j++) {
+			wl_closure_destroy(
+				wl_connection_demarshal(read_connection, size,
+							&objects, message));
+		}
+	}
+
+	wl_closure_destroy(closure);
+	wl_map_release(&objects);
+	wl_connection_destroy(read_connection);
+	wl_connection_destroy(write_connection);
+}
+
+static void
+benchmark(const char *s, const struct wl_message *message,
+	  union wl_argument *args)
+{
+	struct timespec start, stop;
+	double ns[2];
+	int fast;
+
+	for (fast = 0; fast < 2; fast++) {
+		wl_closure_scalar_fast_path = fast;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		round_trip(message, args);
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+
+		ns[fast] = (stop.tv_sec - start.tv_sec) * 1e9 +
+			(stop.tv_nsec - start.tv_nsec);
+		ns[fast] /= ITERATIONS * BATCH;
+	}
+
+	printf("benchmarked %s:\tgeneric %.1fns\tscalar %.1fns\n",
+	       s, ns[0], ns[1]);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct wl_message done = { "done", "u", NULL };
+	static const struct wl_message motion = { "motion", "uff", NULL };
+	static const struct wl_message damage = { "damage", "iiii", NULL };
+	union wl_argument args[4];
+
+	memset(args, 0, sizeof args);
+	args[0].u = 1234;
+	args[1].f = wl_fixed_from_int(100);
+	args[2].f = wl_fixed_from_int(200);
+	args[3].i = 64;
+
+	benchmark("callback.done", &done, args);
+	benchmark("pointer.motion", &motion, args);
+	benchmark("surface.damage", &damage, args);
+
+	return 0;
+}
@@ -21,6 +21,7 @@
  */
 
 #include <assert.h>
+#include <string.h>
 
 #include "wayland-client.h"
 #include "wayland-private.h"
@@ -48,3 +49,59 @@ TEST(message_version)
 		       messages[i].expected_version);
 	}
 }
+
+TEST(message_desc)
+{
+	struct wl_message_desc storage;
+	const struct wl_message_desc *desc;
+	const struct wl_message message = {
+		"test", "2uo?sh?aifn", NULL
+	};
+
+	desc = wl_message_get_desc(&message, &storage);
+	assert(desc->count == 8);
+	assert(desc->since == 2);
+	assert(memcmp(desc->types, "uoshaifn", 8) == 0);
+	assert(desc->nullable == ((1 << 2) | (1 << 4)));
+	assert(desc->fd_count == 1);
+	assert(desc->array_count == 1);
+	assert(desc->fixed_count == 2);
+	assert(desc->fixed_size == 16);
+
+	/* A second lookup hits the cache. */
+	assert(wl_message_get_desc(&message, &storage) == desc);
+
+	desc = wl_message_get_desc(&wl_pointer_interface.methods[WL_POINTER_RELEASE],
+				   &storage);
+	assert(desc->count == 0);
+	assert(desc->since == 3);
+	assert(desc->fixed_size == 8);
+}
+
+TEST(message_desc_changed_signature)
+{
+	struct wl_message_desc storage;
+	const struct wl_message_desc *desc;
+	struct wl_message message = { "test", "us", NULL };
+	const struct wl_message other = { "test", "us", NULL };
+
+	desc = wl_message_get_desc(&message, &storage);
+	assert(desc->count == 2);
+	assert(desc->types[1] == 's');
+
+	/* The cache is keyed by message, so another message with the same
+	 * signature gets its own entry. */
+	assert(wl_message_get_desc(&other, &storage) != desc);
+	assert(wl_message_get_desc(&other, &storage)->count == 2);
+
+	/* A message struct that is reused with a different signature
+	 * doesn't get the stale descriptor. */
+	message.signature = "hoi";
+	desc = wl_message_get_desc(&message, &storage);
+	assert(desc->count == 3);
+	assert(memcmp(desc->types, "hoi", 3) == 0);
+	assert(desc->fd_count == 1);
+
+	/* Both are cached by now. */
+	assert(wl_message_get_desc(&message, &storage) == desc);
+}
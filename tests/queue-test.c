@@ -206,6 +206,65 @@ client_test_queue_roundtrip(void)
 	wl_display_disconnect(display);
 }
 
+static void
+registry_handle_global_lazy(void *data, struct wl_registry *registry,
+			    uint32_t id, const char *interface,
+			    uint32_t version)
+{
+	int *pcounter = data;
+
+	assert(interface && interface[0] != '\0');
+	assert(version >= 1);
+	(*pcounter)++;
+}
+
+static const struct wl_registry_listener registry_listener_lazy = {
+	registry_handle_global_lazy,
+	NULL
+};
+
+/* Test that events queued in wire format with lazy events enabled are
+ * parsed and dispatched on the right queue. */
+static void
+client_test_lazy_events(void)
+{
+	struct wl_event_queue *queue;
+	struct wl_callback *callback;
+	struct wl_registry *registry;
+	struct wl_display *display;
+	bool done = false;
+	int counter = 0;
+
+	display = wl_display_connect(NULL);
+	assert(display);
+	wl_display_set_lazy_events(display, 1);
+
+	registry = wl_display_get_registry(display);
+	assert(registry != NULL);
+	wl_registry_add_listener(registry, &registry_listener_lazy,
+				 &counter);
+
+	queue = wl_display_create_queue(display);
+	assert(queue);
+	callback = wl_display_sync(display);
+	assert(callback != NULL);
+	wl_callback_add_listener(callback, &sync_listener_roundtrip, &done);
+	wl_proxy_set_queue((struct wl_proxy *) callback, queue);
+
+	assert(wl_display_roundtrip(display) > -1);
+	assert(counter >= 4);
+	assert(done == false);
+
+	assert(wl_display_roundtrip_queue(display, queue) > -1);
+	assert(done == true);
+
+	wl_callback_destroy(callback);
+	wl_registry_destroy(registry);
+	wl_event_queue_destroy(queue);
+
+	wl_display_disconnect(display);
+}
+
 static void
 dummy_bind(struct wl_client *client,
 	   void *data, uint32_t version, uint32_t id)
@@ -239,5 +298,8 @@ TEST(queue)
 	client_create(d, client_test_queue_roundtrip);
 	display_run(d);
 
+	client_create(d, client_test_lazy_events);
+	display_run(d);
+
 	display_destroy(d);
 }